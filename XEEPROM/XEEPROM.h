@@ -45,7 +45,103 @@
 #define XEEPROM_h
 
 #include <inttypes.h>
+
+/// No EEPROM at all (i.e. flash-only boards storing through XFlash.h): erased bytes are read
+/// and writes are dropped. Assumed on targets without <avr/eeprom.h> and without page hooks.
+#ifndef XEEPROM_NONE
+#if defined(__has_include) && !defined(XEEPROM_WRITE_PAGE)
+#if !__has_include(<avr/eeprom.h>)
+#define XEEPROM_NONE 1
+#endif
+#endif
+#endif
+
+#ifndef XEEPROM_NONE
+#define XEEPROM_NONE 0
+#endif
+
+#if !XEEPROM_NONE
 #include <avr/eeprom.h>
+#endif
+
+/// Expected erase/write cycles of each EEPROM location
+#ifndef XEEPROM_ENDURANCE
+#define XEEPROM_ENDURANCE 100000UL
+#endif
+
+/// Last address of the EEPROM (i.e. 0x7FFF for an external 24LC256, -1 without EEPROM)
+#ifndef XEEPROM_END
+#if XEEPROM_NONE
+#define XEEPROM_END (-1)
+#else
+#define XEEPROM_END E2END
+#endif
+#endif
+
+/// Bytes of the readahead window of single byte reads (0 for none, 8 .. 64 for slow backends
+/// where each transaction is expensive, i.e. external I2C EEPROM)
+#ifndef XEEPROM_READAHEAD
+#define XEEPROM_READAHEAD 0
+#endif
+
+#if XEEPROM_READAHEAD
+/// Readahead window shared by all instances, so that any write through one of them keeps it coherent
+struct XEEPROMWindow
+{
+    int begin;
+    int size;
+    uint8_t data[XEEPROM_READAHEAD];
+};
+
+inline XEEPROMWindow &XEEPROMReadahead()
+{
+    static XEEPROMWindow window = { 0, 0, { 0 } };
+    return window;
+}
+#endif
+
+/// Bytes of each page of an external page-oriented EEPROM (0 for the internal EEPROM).
+/// Written bytes are gathered into a single page write cycle through the hooks:
+///  - XEEPROM_READ_BLOCK(address, data, size): read consecutive bytes
+///  - XEEPROM_WRITE_PAGE(address, data, size): start a write cycle of bytes within a page
+///  - XEEPROM_READY(): true when the device acknowledges again (acknowledge polling)
+#ifndef XEEPROM_PAGE_SIZE
+#define XEEPROM_PAGE_SIZE 0
+#endif
+
+/// Erase-only and write-only cycles for erase and program (0 for atomic cycles only), enabled
+/// by default on the internal EEPROM of devices providing the EEPM bits or on targets providing
+/// XEEPROM_ERASE_BYTE and XEEPROM_PROGRAM_BYTE. A write-only cycle takes about half of an atomic
+/// one: update picks it for each change moving bits from 1 to 0 only (see XTable::BITCLEAR_STATUS)
+/// and for each location erased in advance (see XTable::PreEraseStorage).
+#ifndef XEEPROM_SPLIT_CYCLES
+#if (!XEEPROM_PAGE_SIZE) && (!XEEPROM_NONE) && ((defined(EEPM0) && defined(EEPM1)) || defined(XEEPROM_ERASE_BYTE))
+#define XEEPROM_SPLIT_CYCLES 1
+#else
+#define XEEPROM_SPLIT_CYCLES 0
+#endif
+#endif
+
+#if XEEPROM_SPLIT_CYCLES && defined(EEPM0) && defined(EEPM1) && !defined(XEEPROM_ERASE_BYTE)
+#include <avr/interrupt.h>
+#endif
+
+#if XEEPROM_PAGE_SIZE
+/// Page gathering written bytes, shared by all instances so that bursts keep the order of writes
+struct XEEPROMPage
+{
+    int begin;                                  ///< First address of the page (-1 for none)
+    bool busy;                                  ///< Write cycle in progress
+    uint8_t dirty[(XEEPROM_PAGE_SIZE+7)/8];     ///< Written bytes of the page
+    uint8_t data[XEEPROM_PAGE_SIZE];
+};
+
+inline XEEPROMPage &XEEPROMPending()
+{
+    static XEEPROMPage page = { -1, false, { 0 }, { 0 } };
+    return page;
+}
+#endif
 
 
 template <class X> class XEEPROM
@@ -57,43 +153,293 @@ template <class X> class XEEPROM
     /// Standard function to write single byte from EEPROM
     void write(int, uint8_t);
 
+    /// Function to erase single byte of EEPROM (erase-only cycle, the byte becomes 0xFF)
+    void erase(int address);
+
+    /// Function to program single byte of an erased EEPROM location (write-only cycle)
+    void program(int address, uint8_t value);
+
+    /// Function to write single byte of EEPROM through the quickest cycle (unchanged bytes are skipped,
+    /// bit-clear changes need no erase)
+    void update(int address, uint8_t value);
+
     /// Extended function to read structure from EEPROM
     X* Read(int address);
 
+    /// Extended function to read one or more consecutive structures from EEPROM into specified buffer
+    void Read(int address, X *value, unsigned int count = 1);
+
     /// Extended function to write structure from EEPROM
     void Write(int address, X value);
 
-    /// Function to clean specified piece of EEPROM
+    /// Extended function to update one or more consecutive structures on EEPROM (only changed bytes are written)
+    void Update(int address, const X *value, unsigned int count = 1);
+
+    /// Function to clean specified piece of EEPROM (unchanged bytes are skipped)
     void Fill(int address, unsigned int size, uint8_t value);
 
+    /// Function to erase specified piece of EEPROM (already erased bytes are skipped)
+    void Erase(int address, unsigned int size);
+
+    /// Function to write pending bytes of a page-oriented EEPROM (see XEEPROM_PAGE_SIZE)
+    void Flush();
+
     /// Function to manage EEPROM size limit
     int Limit();
 
   private:
     X *X_value = new(X);
+
+#if XEEPROM_SPLIT_CYCLES && defined(EEPM0) && defined(EEPM1)
+    /// Start single EEPROM programming cycle with specified mode (EEPM bits of EECR)
+    void Cycle(int address, uint8_t value, uint8_t mode);
+#endif
+
+    /// Keep the readahead window coherent with a written byte (new value = (old value & mask) | value)
+    void Track(int address, uint8_t value, uint8_t mask = 0x00);
+
+    /// Read consecutive bytes from EEPROM, pending bytes included
+    void ReadBlock(int address, uint8_t *data, unsigned int size);
+
+#if XEEPROM_PAGE_SIZE
+    /// Put a written byte into the pending page, writing the previous page if different
+    void Stage(int address, uint8_t value);
+
+    /// Acknowledge polling of the write cycle in progress
+    void Wait();
+#endif
 };
 
 
+/// With XEEPROM_READAHEAD, a byte beyond the window moves the window to it
+/// through a single block transaction
 template <class X> uint8_t XEEPROM<X>::read(int address)
 {
+#if XEEPROM_READAHEAD
+    XEEPROMWindow &window = XEEPROMReadahead();
+
+    if ((address < window.begin) || (address >= window.begin + window.size))
+    {
+        window.begin = address;
+        window.size = (XEEPROM_END + 1 - address < XEEPROM_READAHEAD ? XEEPROM_END + 1 - address : XEEPROM_READAHEAD);
+        ReadBlock(window.begin, window.data, window.size);
+    }
+
+    return window.data[address - window.begin];
+#elif XEEPROM_PAGE_SIZE
+    uint8_t value;
+
+    ReadBlock(address, &value, 1);
+    return value;
+#elif XEEPROM_NONE
+    (void) address;
+    return 0xFF;
+#else
 	return eeprom_read_byte((unsigned char *) address);
+#endif
 }
 
 template <class X> void XEEPROM<X>::write(int address, uint8_t value)
 {
+#if XEEPROM_PAGE_SIZE
+    Stage(address, value);
+#elif !XEEPROM_NONE
 	eeprom_write_byte((unsigned char *) address, value);
+#endif
+	Track(address, value);
+}
+
+template <class X> void XEEPROM<X>::ReadBlock(int address, uint8_t *data, unsigned int size)
+{
+#if XEEPROM_PAGE_SIZE
+    XEEPROMPage &page = XEEPROMPending();
+    int offset;
+
+    Wait();
+    XEEPROM_READ_BLOCK(address, data, size);
+
+    /// Bytes still pending override the stored ones
+    for (unsigned int j=0; (page.begin >= 0) && (j<size); j++)
+    {
+        offset = address + j - page.begin;
+        if ((offset >= 0) && (offset < XEEPROM_PAGE_SIZE) && (page.dirty[offset/8] & (1 << (offset%8))))
+            data[j] = page.data[offset];
+    }
+#elif XEEPROM_NONE
+    (void) address;
+    memset(data, 0xFF, size);
+#else
+    eeprom_read_block((void *) data, (const void *) address, size);
+#endif
+}
+
+#if XEEPROM_PAGE_SIZE
+/// Bytes written to the same page are kept until a byte of another page is written or Flush is called,
+/// so that each page is written through a single cycle (i.e. 5 ms for up to 64 bytes of a 24LC256)
+template <class X> void XEEPROM<X>::Stage(int address, uint8_t value)
+{
+    XEEPROMPage &page = XEEPROMPending();
+    int offset;
+
+    if ((page.begin < 0) || (address < page.begin) || (address >= page.begin + XEEPROM_PAGE_SIZE))
+    {
+        Flush();
+        page.begin = address - address % XEEPROM_PAGE_SIZE;
+    }
+
+    offset = address - page.begin;
+    page.data[offset] = value;
+    page.dirty[offset/8] |= (1 << (offset%8));
+}
+
+template <class X> void XEEPROM<X>::Wait()
+{
+    XEEPROMPage &page = XEEPROMPending();
+
+    while ((page.busy) && (!XEEPROM_READY()));
+    page.busy = false;
+}
+#endif
+
+/// A single write cycle covers the pending bytes from the first to the last one. Bytes between
+/// them that were not written are read first, through a single block read.
+template <class X> void XEEPROM<X>::Flush()
+{
+#if XEEPROM_PAGE_SIZE
+    XEEPROMPage &page = XEEPROMPending();
+    uint8_t stored[XEEPROM_PAGE_SIZE];
+    int first = XEEPROM_PAGE_SIZE;
+    int last = -1;
+    bool gap = false;
+
+    if (page.begin < 0) return;
+
+    for (int j=0; j<XEEPROM_PAGE_SIZE; j++)
+    {
+        if (!(page.dirty[j/8] & (1 << (j%8)))) continue;
+        if (last >= 0) gap |= (last < j-1);
+        else first = j;
+        last = j;
+    }
+
+    if (last >= 0)
+    {
+        Wait();
+        if (gap)
+        {
+            XEEPROM_READ_BLOCK(page.begin + first, stored + first, last - first + 1);
+            for (int j=first; j<=last; j++)
+                if (!(page.dirty[j/8] & (1 << (j%8)))) page.data[j] = stored[j];
+        }
+
+        XEEPROM_WRITE_PAGE(page.begin + first, page.data + first, last - first + 1);
+        page.busy = true;
+    }
+
+    memset(page.dirty, 0, sizeof(page.dirty));
+    page.begin = -1;
+#endif
+}
+
+/// Written bytes are copied into the window rather than discarding it, so that
+/// read-modify-write loops (update, Fill, Update) keep it
+template <class X> void XEEPROM<X>::Track(int address, uint8_t value, uint8_t mask)
+{
+#if XEEPROM_READAHEAD
+    XEEPROMWindow &window = XEEPROMReadahead();
+
+    if ((address >= window.begin) && (address < window.begin + window.size))
+        window.data[address - window.begin] = (window.data[address - window.begin] & mask) | value;
+#else
+    (void) address;
+    (void) value;
+    (void) mask;
+#endif
+}
+
+/// With XEEPROM_SPLIT_CYCLES, split programming modes are available on devices providing the EEPM bits
+/// (e.g. ATmega328P: 3.4 ms atomic cycle, 1.8 ms erase-only or write-only cycle).
+/// XEEPROM_ERASE_BYTE and XEEPROM_PROGRAM_BYTE may be defined to provide them on other targets.
+/// Otherwise erase and program are atomic cycles as write.
+template <class X> void XEEPROM<X>::erase(int address)
+{
+#if XEEPROM_PAGE_SIZE
+    Stage(address, 0xFF);
+#elif XEEPROM_SPLIT_CYCLES && defined(XEEPROM_ERASE_BYTE)
+    XEEPROM_ERASE_BYTE(address);
+#elif XEEPROM_SPLIT_CYCLES && defined(EEPM0) && defined(EEPM1)
+    Cycle(address, 0xFF, _BV(EEPM0));
+#elif !XEEPROM_NONE
+    eeprom_write_byte((unsigned char *) address, 0xFF);
+#endif
+    Track(address, 0xFF);
 }
 
+template <class X> void XEEPROM<X>::program(int address, uint8_t value)
+{
+#if XEEPROM_PAGE_SIZE
+    /// Page-oriented devices have no write-only cycle (an erased location is expected)
+    Stage(address, value);
+#elif XEEPROM_SPLIT_CYCLES && defined(XEEPROM_PROGRAM_BYTE)
+    XEEPROM_PROGRAM_BYTE(address, value);
+#elif XEEPROM_SPLIT_CYCLES && defined(EEPM0) && defined(EEPM1)
+    Cycle(address, value, _BV(EEPM1));
+#elif !XEEPROM_NONE
+    /// Atomic cycle of the value expected after a write-only cycle
+    eeprom_write_byte((unsigned char *) address, eeprom_read_byte((unsigned char *) address) & value);
+#endif
+    /// A write-only cycle only moves bits from 1 to 0
+    Track(address, 0x00, value);
+}
+
+template <class X> void XEEPROM<X>::update(int address, uint8_t value)
+{
+    uint8_t current = read(address);
+
+    if (current == value) return;
+
+    /// A write-only cycle can move bits from 1 to 0 only (erase and program are atomic cycles
+    /// as write without XEEPROM_SPLIT_CYCLES)
+    if (value == 0xFF) erase(address);
+    else if ((current & value) == value) program(address, value);
+    else write(address, value);
+}
+
+#if XEEPROM_SPLIT_CYCLES && defined(EEPM0) && defined(EEPM1)
+template <class X> void XEEPROM<X>::Cycle(int address, uint8_t value, uint8_t mode)
+{
+    uint8_t sreg;
+
+    eeprom_busy_wait();
+
+    sreg = SREG;
+    cli();
+
+    EEAR = address;
+    EEDR = value;
+    EECR = mode;
+    EECR |= _BV(EEMPE);
+    EECR |= _BV(EEPE);
+
+    SREG = sreg;
+}
+#endif
+
 template <class X> X* XEEPROM<X>::Read(int address)
 {
     uint8_t b[sizeof(*X_value)];
     for (int j=0; j<sizeof(*X_value); j++)
- 	b[j] = eeprom_read_byte((unsigned char *) address+j);
+ 	b[j] = read(address+j);
 
     memcpy(X_value, b, sizeof(*X_value));
     return X_value;
 }
 
+template <class X> void XEEPROM<X>::Read(int address, X *value, unsigned int count)
+{
+    ReadBlock(address, (uint8_t *) value, count*sizeof(X));
+}
+
 template <class X> void XEEPROM<X>::Write(int address, X value)
 {
     uint8_t b[sizeof(value)];
@@ -101,18 +447,41 @@ template <class X> void XEEPROM<X>::Write(int address, X value)
     memcpy(b, &value, sizeof(value));
 
     for (int j=0; j<sizeof(value); j++)
-    	eeprom_write_byte((unsigned char *) address+j, b[j]);
+    	write(address+j, b[j]);
+}
+
+/// Atomic cycles of the internal EEPROM go through the block primitive (eeprom_update_block),
+/// otherwise each byte picks its own cycle or joins the pending page
+template <class X> void XEEPROM<X>::Update(int address, const X *value, unsigned int count)
+{
+    const uint8_t *b = (const uint8_t *) value;
+
+#if (!XEEPROM_PAGE_SIZE) && (!XEEPROM_SPLIT_CYCLES) && (!XEEPROM_NONE)
+    eeprom_update_block((const void *) b, (void *) address, count*sizeof(X));
+
+    for (unsigned int j=0; j<count*sizeof(X); j++)
+        Track(address+j, b[j]);
+#else
+    for (unsigned int j=0; j<count*sizeof(X); j++)
+        update(address+j, b[j]);
+#endif
 }
 
 template <class X> void XEEPROM<X>::Fill(int address, unsigned int size, uint8_t value)
 {
-    for (int j=0; j<size; j++)
-        eeprom_write_byte((unsigned char *) address+j, value);
+    for (unsigned int j=0; j<size; j++)
+        update(address+j, value);
+}
+
+template <class X> void XEEPROM<X>::Erase(int address, unsigned int size)
+{
+    for (unsigned int j=0; j<size; j++)
+        if (read(address+j) != 0xFF) erase(address+j);
 }
 
 template <class X> int XEEPROM<X>::Limit()
 {
-    return E2END;
+    return XEEPROM_END;
 }
 
 #endif
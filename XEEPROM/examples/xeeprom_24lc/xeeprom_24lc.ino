@@ -0,0 +1,100 @@
+/**
+ *  @file    xeeprom_24lc.ino
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *  @brief XEEPROM on an external 24LC256 I2C EEPROM
+ *
+ *  @section DESCRIPTION
+ *
+ *  This application is meant as example. It shows how to provide the hooks
+ *  of a page-oriented external EEPROM (see XEEPROM_PAGE_SIZE). Bytes written
+ *  to the same page are gathered into a single write cycle and each cycle is
+ *  completed through acknowledge polling of the device.
+ *
+ *  The 32 byte buffer of Wire holds 2 address bytes and up to 30 data bytes,
+ *  so the 64 byte pages of the 24LC256 are managed as 16 byte pages (they
+ *  never cross a boundary of the device pages).
+ *
+ *  This example is part of XDAQ v1.0 Project.
+ *  This code is in the public domain.
+ *
+ *  See more at www.embeddedrevolution.info
+ *
+ */
+
+#include <Wire.h>
+
+/// I2C address of the 24LC256 (A0..A2 to GND)
+#define DEVICE 0x50
+
+void ext_read(int address, uint8_t *data, unsigned int size)
+{
+  Wire.beginTransmission(DEVICE);
+  Wire.write(address >> 8);
+  Wire.write(address & 0xFF);
+  Wire.endTransmission();
+
+  Wire.requestFrom((uint8_t) DEVICE, (uint8_t) size);
+  for (unsigned int j=0; j<size; j++) data[j] = Wire.read();
+}
+
+void ext_write(int address, const uint8_t *data, unsigned int size)
+{
+  Wire.beginTransmission(DEVICE);
+  Wire.write(address >> 8);
+  Wire.write(address & 0xFF);
+  Wire.write(data, size);
+  Wire.endTransmission();
+}
+
+/// The device does not acknowledge its address during a write cycle
+bool ext_ready()
+{
+  Wire.beginTransmission(DEVICE);
+  return (Wire.endTransmission() == 0);
+}
+
+#define XEEPROM_END 0x7FFF
+#define XEEPROM_PAGE_SIZE 16
+#define XEEPROM_READAHEAD 16
+#define XEEPROM_READ_BLOCK(address, data, size) ext_read(address, (uint8_t *) (data), size)
+#define XEEPROM_WRITE_PAGE(address, data, size) ext_write(address, data, size)
+#define XEEPROM_READY() ext_ready()
+
+#include <XEEPROM.h>
+
+XEEPROM<byte> ext_eeprom;
+
+void setup()
+{
+  unsigned long start;
+
+  Wire.begin();
+  Wire.setClock(400000);
+
+  /// initialize serial and wait for port to open:
+  Serial.begin(115200);
+  while (!Serial) {
+    ; /// wait for serial port to connect. Needed for Leonardo only
+  }
+
+  /// 100 consecutive bytes take 7 page write cycles rather than 100
+  start = millis();
+  for (int address=0; address<100; address++) ext_eeprom.update(address, address);
+  ext_eeprom.Flush();
+
+  Serial.print("100 bytes written in ");
+  Serial.print(millis() - start);
+  Serial.println(" ms");
+
+  for (int address=0; address<100; address++)
+  {
+    if (ext_eeprom.read(address) != address) Serial.println("Unexpected value");
+  }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,156 @@
+/********************************************************************************
+ *   BenchXTable - Benchmark of access by position for XTable Class             *
+ *   Copyright (C) 2015 by AF                                    				        *
+ *                                                                              *
+ *   This file is part of XDAQ Virtual Appliance                                *
+ *   (see more on www.embeddedrevolution.info).                                 *
+ *                                                                              *
+ *   BenchXTable is free software: you can redistribute it and/or modify it     *
+ *   under the terms of the GNU Lesser General Public License as published      *
+ *   by the Free Software Foundation, either version 3 of the License, or       *
+ *   (at your option) any later version.                                        *
+ *                                                                              *
+ *   BenchXTable is distributed in the hope that it will be useful,             *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ *   GNU Lesser General Public License for more details.                        *
+ *                                                                              *
+ *   You should have received a copy of the GNU Lesser General Public           *
+ *   License along with BenchXTable. If not, see <http:///www.gnu.org/licenses/>*
+ ********************************************************************************/
+
+/**
+ *  @file    BenchXTable.cpp (or BenchXTable.ino)
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *	@brief Benchmark of random access by position (At) against the walk through Top and Next
+ *
+ *  @section DESCRIPTION
+ *
+ *  Each run fills a table, optionally deletes 10% of its items at random positions,
+ *  then reads items at random positions through At and through a walk from Top.
+ *  The time of random() alone is measured apart and subtracted from both.
+ *  Results are printed as nanoseconds per access:\n
+ *  XBENCH,<items>,<holes>,<At ns>,<Top+Next ns>
+ *
+ *  Tables of 255 items run on any board. Tables of 1M items need 32 bit
+ *  targets with enough SRAM (or a host build), so they are left out on AVR.
+ */
+
+#include "XTable.h"
+
+/// Accesses timed for each run (walks of large tables are limited to BENCH_WALKS)
+#if defined(__AVR__)
+#define BENCH_READS 2000UL
+#else
+#define BENCH_READS 1000000UL
+#endif
+#define BENCH_WALKS 20UL
+
+/// Small item, so that 255 of them fit the SRAM of the smallest boards
+struct T_SAMPLE
+{
+	uint16_t value;
+};
+
+volatile unsigned long bench_sink;
+
+/// Nanoseconds of each access, time of random() excluded
+unsigned long PerAccess(unsigned long elapsed, unsigned long overhead, unsigned long reads)
+{
+	elapsed = (elapsed > overhead ? elapsed - overhead : 0);
+
+	return (elapsed / reads)*1000UL + (elapsed % reads)*1000UL/reads;
+}
+
+void Bench(unsigned long items, bool holes)
+{
+	XTable<T_SAMPLE> table;
+	T_SAMPLE sample;
+	unsigned long start;
+	unsigned long overhead;
+	unsigned long at_ns;
+	unsigned long walk_ns;
+	unsigned long reads;
+	unsigned long k;
+
+	if (!table.InitBuffer(items))
+	{
+		Serial.println("\n*** Error: cannot allocate required memory ***");
+		return;
+	}
+
+	for (unsigned long i=0; i<items; i++)
+	{
+		sample.value = i;
+		table.Insert(sample);
+	}
+
+	if (holes)
+		for (unsigned long i=0; i<items/10; i++)
+		{
+			table.Seek(random(table.Counter()));
+			table.Delete();
+		}
+
+	/// Positions are built once before timing (see At)
+	table.At(0);
+
+	randomSeed(1);
+	start = micros();
+	for (unsigned long r=0; r<BENCH_READS; r++) bench_sink += random(table.Counter());
+	overhead = micros() - start;
+
+	randomSeed(1);
+	start = micros();
+	for (unsigned long r=0; r<BENCH_READS; r++) bench_sink += table.At(random(table.Counter()))->value;
+	at_ns = PerAccess(micros() - start, overhead, BENCH_READS);
+
+	reads = (items > 1000 ? BENCH_WALKS : BENCH_READS);
+	randomSeed(1);
+	start = micros();
+	for (unsigned long r=0; r<reads; r++)
+	{
+		k = random(table.Counter());
+		table.Top();
+		while (k--) table.Next();
+		bench_sink += table.Select()->value;
+	}
+	walk_ns = PerAccess(micros() - start, overhead/(BENCH_READS/reads), reads);
+
+	Serial.print("XBENCH,");
+	Serial.print(items);
+	Serial.print(",");
+	Serial.print(holes ? 10 : 0);
+	Serial.print("%,");
+	Serial.print(at_ns);
+	Serial.print(",");
+	Serial.println(walk_ns);
+}
+
+
+
+int main(int argc, char *argv[]) {
+	init();
+
+	/// Init serial communications and wait for port to open:
+	Serial.begin(115200);
+
+	/// Wait for serial port to connect (this is an optional condition board related)
+	while (!Serial);
+	delay(50);
+
+	Serial.println("Bench XTable Arduino Class");
+
+	Bench(255, false);
+	Bench(255, true);
+#if !defined(__AVR__)
+	Bench(1000000UL, false);
+	Bench(1000000UL, true);
+#endif
+
+	delay(200);
+	exit(0);
+}
@@ -39,11 +39,19 @@
  *  configuration purpose, with CRUD API approach (Create, Read, Update and Delete).
  *  It manages generic structured items through an efficient storage using a
  *  circular buffer in EEPROM and volatile SRAM.
+ *
+ *  EEPROM layout: since version 2.0 an XDirectory at address 0 assigns the regions
+ *  of <a> and <b> configuration and of the selection slot. Up to version 1.x a pointer
+ *  to the current configuration (BMK and address) was kept at address 0, <a> was stored
+ *  from address 3 and <b> right after it. Configurations stored by version 1.x are moved
+ *  once into the regions of the directory at the first start (see LoadLegacyLayout):
+ *  a power loss while they are moved restores the default configurations.
  */
 
 
 #include <Firmata.h>
 #include "XTable.h"
+#include "XDirectory.h"
 
 #define DEBUG(value) Serial.print("\n"); Serial.print(__LINE__); Serial.print(":"); Serial.print(#value); Serial.print("="); Serial.println(value);
 
@@ -64,11 +72,19 @@ bool refreshLEDs;
 
 /// EEPROM parameters and flags to switch between <a> and <b> configuration
 int size_buffer = 18;
-int start_address_a = 3;
+int start_address_a;
+int start_address_b;
 int start_address;
-int addr_conf;
-int addr_conf_a;
-int addr_conf_b;
+
+/// Wear leveled slot keeping current configuration between <a> (profile 0) and <b> (profile 1)
+int selection_size = 8;
+int selection_address;
+
+/// Directory of EEPROM regions assigned to <a> and <b> configuration and to the selection slot
+XDirectory configurations;
+
+/// Start address of <a> configuration up to version 1.x (<b> follows it)
+int legacy_address_a = 3;
 
 
 /// Example of structure related to Blinking Project
@@ -82,6 +98,19 @@ struct T_LED
 
 XTable<T_LED> blinking_LEDs;
 
+/// Default <a> and <b> configurations kept on flash (Pin 14 is virtual for delay scope)
+const T_LED default_conf_a[] PROGMEM =
+{
+	{ 2, false, 500 }, { 3, false, 500 }, { 4, false, 500 }, { 5, false, 500 }, { 6, false, 500 }, { 14, true, 700 },
+	{ 6, true, 100 }, { 5, true, 100 }, { 4, true, 100 }, { 3, true, 100 }, { 2, true, 100 }, { 14, true, 700 }
+};
+
+const T_LED default_conf_b[] PROGMEM =
+{
+	{ 2, true, 100 }, { 3, true, 100 }, { 4, true, 100 }, { 5, true, 100 }, { 6, true, 100 }, { 14, true, 700 },
+	{ 6, true, 100 }, { 5, true, 100 }, { 4, true, 100 }, { 3, true, 100 }, { 2, true, 100 }, { 14, true, 700 }
+};
+
 
 void digitalWriteCallback(byte port, int value)
 {
@@ -115,44 +144,11 @@ bool CheckArduinoUnoPinId(int pin)
 
 bool CreateDefaultConf()
 {
-	blinking_LEDs.Clean();
-
-	for(id=2; id<5+2; id++)
-	{
-		LED.pin = id;
-		if (start_address == start_address_a)
-		{
-			LED.blinking = false;
-			LED.delay_ms = 500;
-		}
-		else
-		{
-			LED.blinking = true;
-			LED.delay_ms = 100;
-		}
-
-		blinking_LEDs.Insert(LED);
-	}
-
-	/// Add virtual LED
-	LED.pin = 14;
-	LED.blinking = true;
-	LED.delay_ms = 700;
-	blinking_LEDs.Insert(LED);
-
-	for(id=5+1; id>1; id--)
-	{
-		LED.pin = id;
-		LED.blinking = true;
-		LED.delay_ms = 100;
-		blinking_LEDs.Insert(LED);
-	}
-
-	/// Add virtual LED
-	LED.pin = 14;
-	LED.blinking = true;
-	LED.delay_ms = 700;
-	blinking_LEDs.Insert(LED);
+	/// Default items are read from flash, each of them is copied to SRAM only once changed
+	if (start_address == start_address_a)
+		blinking_LEDs.InitDefaults(default_conf_a, sizeof(default_conf_a)/sizeof(T_LED));
+	else
+		blinking_LEDs.InitDefaults(default_conf_b, sizeof(default_conf_b)/sizeof(T_LED));
 
 	return (blinking_LEDs.Counter()>0);
 }
@@ -202,6 +198,51 @@ bool GetConfiguration()
 	return false;
 }
 
+/// Configurations stored by version 1.x are loaded into their profiles before the directory
+/// overwrites them: returns the configuration selected last (0 for <a>, 1 for <b>) or -1 for none
+int LoadLegacyLayout()
+{
+	int legacy_address_b = legacy_address_a + blinking_LEDs.SizeStorage(size_buffer);
+	int selected;
+
+	if (blinking_LEDs.eeprom.read(0) == configurations.DMK) return -1;
+
+	/// Markers of the storage checked first, since InitStorage formats an unknown one
+	if ((blinking_LEDs.eeprom.read(legacy_address_a) != blinking_LEDs.BMK) ||
+		(blinking_LEDs.eeprom.read(legacy_address_a+1) != size_buffer) ||
+		(blinking_LEDs.eeprom.read(legacy_address_a+size_buffer+2) != blinking_LEDs.EMK)) return -1;
+
+	selected = ((blinking_LEDs.eeprom.read(0) == blinking_LEDs.BMK) &&
+				((blinking_LEDs.eeprom.read(1) << 8) + blinking_LEDs.eeprom.read(2) == legacy_address_b) ? 1 : 0);
+
+	blinking_LEDs.SelectProfile(0);
+	if ((!blinking_LEDs.InitStorage(legacy_address_a, size_buffer)) || (!blinking_LEDs.LoadStorage())) return -1;
+
+	blinking_LEDs.SelectProfile(1);
+	if ((blinking_LEDs.eeprom.read(legacy_address_b) == blinking_LEDs.BMK) &&
+		(blinking_LEDs.eeprom.read(legacy_address_b+1) == size_buffer) &&
+		(blinking_LEDs.eeprom.read(legacy_address_b+size_buffer+2) == blinking_LEDs.EMK) &&
+		(blinking_LEDs.InitStorage(legacy_address_b, size_buffer)))
+		blinking_LEDs.LoadStorage();
+
+	blinking_LEDs.SelectProfile(0);
+	return selected;
+}
+
+/// Loaded configurations of version 1.x stored into the regions assigned by the directory
+void StoreLegacyLayout(int selected)
+{
+	blinking_LEDs.SelectProfile(1);
+	if (blinking_LEDs.InitStorage(start_address_b, size_buffer)) blinking_LEDs.SaveStorage();
+
+	blinking_LEDs.SelectProfile(0);
+	if (blinking_LEDs.InitStorage(start_address_a, size_buffer)) blinking_LEDs.SaveStorage();
+
+	blinking_LEDs.SelectProfile(selected);
+	blinking_LEDs.SaveProfile(selection_address, selection_size);
+	blinking_LEDs.SelectProfile(0);
+}
+
 void ShowConfiguration()
 {
 	Serial.print("\r\nConfiguation format: LED(pin, blinking status, delay msec)\r\n");
@@ -228,32 +269,57 @@ void ShowConfiguration()
 
 void setup()
 {
+	int legacy_selected;
+
 	/// Start serial console mode
 	Serial.begin(115200);
 	delay(100);
 
 	Serial.print("\r\n\n\n*** Start BlinkingLEDs sketch ***\r\nFirmata protocol will starts within 5 sec.\r\n\n");
 
-	if (!blinking_LEDs.InitBuffer(30))
+	if ((!blinking_LEDs.InitBuffer(30)) || (!blinking_LEDs.InitProfiles(2)))
 	{
 		Serial.print("Error: cannot allocate required memory\r\n");
 		delay(100);
 		exit(0);
 	}
 
-	/// Check current configuration and create default setting
-	start_address = -1;
-	if (blinking_LEDs.eeprom.read(0)==blinking_LEDs.BMK)
+	/// Console saves coalesced within 2 sec, no more than 6 each hour
+	blinking_LEDs.SetSavePolicy(2000, 6, 3600000UL);
+
+	/// Configurations of version 1.x, if any
+	legacy_selected = LoadLegacyLayout();
+
+	/// Assign EEPROM regions of <a> and <b> configuration and selection slot (only the first time)
+	start_address_a = -1;
+	start_address_b = -1;
+	selection_address = -1;
+	if (configurations.InitDirectory(0, 3))
 	{
-		start_address = (blinking_LEDs.eeprom.read(1) << 8) + blinking_LEDs.eeprom.read(2);
-	    if (start_address > blinking_LEDs.eeprom.Limit()) start_address = -1;
+		start_address_a = configurations.Allocate(0, blinking_LEDs.SizeStorage(size_buffer));
+		start_address_b = configurations.Allocate(1, blinking_LEDs.SizeStorage(size_buffer));
+		selection_address = configurations.Allocate(2, selection_size);
 	}
 
-	if (start_address < 0)
+	if ((start_address_a < 0) || (start_address_b < 0) || (selection_address < 0))
 	{
-		blinking_LEDs.eeprom.write(0,blinking_LEDs.BMK);
-		blinking_LEDs.eeprom.write(1,0);
-		blinking_LEDs.eeprom.write(2,start_address_a);
+		Serial.print("Error: cannot assign required EEPROM\r\n");
+		delay(100);
+		exit(0);
+	}
+
+	if (legacy_selected >= 0)
+	{
+		Serial.print("Configurations moved to the new EEPROM layout\r\n");
+		StoreLegacyLayout(legacy_selected);
+	}
+
+	/// Keep both configurations resident: <b> on profile 1 and <a> on profile 0
+	blinking_LEDs.SelectProfile(1);
+	start_address = start_address_b;
+	if (GetConfiguration())
+	{
+		blinking_LEDs.SelectProfile(0);
 		start_address = start_address_a;
 	}
 
@@ -264,6 +330,13 @@ void setup()
 		exit(0);
 	}
 
+	/// Start from last selected configuration
+	if (blinking_LEDs.LoadProfile(selection_address, selection_size) == 1)
+	{
+		blinking_LEDs.SelectProfile(1);
+		start_address = start_address_b;
+	}
+
 	/// Set pin included on LED configuration
 	SetOutputConf();
 
@@ -289,6 +362,9 @@ void setup()
 
 void loop()
 {
+    /// Pending save of current configuration
+    blinking_LEDs.FlushStorage(millis());
+
     if (!firmata_mode)
     {
     	/// Wait commmands from terminal or skip Console Mode after 5 sec.
@@ -340,8 +416,8 @@ void loop()
 		/// "s" Save configuration
 		if (nChoice==115)
 		{
-			blinking_LEDs.SaveStorage();
-			Serial.print("Configuration saved successfully.\r\n\n");
+			if (blinking_LEDs.RequestSave(millis())) Serial.print("Configuration saved successfully.\r\n\n");
+			else Serial.print("Configuration will be saved shortly.\r\n\n");
 			nChoice = -1;
 		}
 
@@ -354,12 +430,7 @@ void loop()
 			if (Serial.available() > 0) nChoice = Serial.parseInt();
 
 			/// Check request within existing configurations
-			blinking_LEDs.Top();
-			id=0;
-			do
-			{
-				if ((id++)==nChoice) { nMenu = 1; break; }
-			} while (blinking_LEDs.Next());
+			if ((nChoice >= 0) && (blinking_LEDs.Seek(nChoice))) nMenu = 1;
 
 			if (nMenu==1)
 			{
@@ -407,6 +478,7 @@ void loop()
 		if (nChoice==101)
 		{
 		  Serial.print("*** Leave Console Mode. Start Firmata Mode. ***\r\n\n\n");
+		  blinking_LEDs.FlushStorage();
 		  Serial.end();
 		  Firmata.begin(115200);
 		  firmata_mode = true;
@@ -443,18 +515,18 @@ void loop()
         	{
         		if (!firmata_mode) Serial.print("<a>\r\n");
 				start_address = start_address_a;
-				blinking_LEDs.eeprom.write(0,0);
-				blinking_LEDs.eeprom.write(1,start_address_a);
+				blinking_LEDs.SelectProfile(0);
         	}
         	else
         	{
         		if (!firmata_mode) Serial.print("<b>\r\n");
-        		start_address = blinking_LEDs.NextFreeAddressStorage();
-				blinking_LEDs.eeprom.write(1, start_address >> 8);
-				blinking_LEDs.eeprom.write(2, start_address & 0x00FF);
+				start_address = start_address_b;
+				blinking_LEDs.SelectProfile(1);
         	}
 
-        	if (!GetConfiguration()) exit(0);
+        	/// Play the other configuration from its first LED
+        	blinking_LEDs.SaveProfile(selection_address, selection_size);
+        	blinking_LEDs.Top();
         	nChoice = -1;
         }
 
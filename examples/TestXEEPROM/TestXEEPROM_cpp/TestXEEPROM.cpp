@@ -0,0 +1,301 @@
+/********************************************************************************
+ *   TestXEEPROM - Unit Test for XEEPROM page-oriented backend                  *
+ *   Copyright (C) 2015 by AF                                    				        *
+ *                                                                              *
+ *   This file is part of XDAQ Virtual Appliance                                *
+ *   (see more on www.embeddedrevolution.info).                                 *
+ *                                                                              *
+ *   TestXEEPROM is free software: you can redistribute it and/or modify it     *
+ *   under the terms of the GNU Lesser General Public License as published      *
+ *   by the Free Software Foundation, either version 3 of the License, or       *
+ *   (at your option) any later version.                                        *
+ *                                                                              *
+ *   TestXEEPROM is distributed in the hope that it will be useful,             *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ *   GNU Lesser General Public License for more details.                        *
+ *                                                                              *
+ *   You should have received a copy of the GNU Lesser General Public           *
+ *   License along with TestXEEPROM. If not, see <http:///www.gnu.org/licenses/>*
+ ********************************************************************************/
+
+/**
+ *  @file    TestXEEPROM.cpp (or TestXEEPROM.ino)
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *	@brief Unit Test application for the readahead window and the page writes of XEEPROM
+ *
+ *  @section DESCRIPTION
+ *
+ *  This unit test builds XEEPROM with XEEPROM_READAHEAD and XEEPROM_PAGE_SIZE on top
+ *  of a page-oriented external EEPROM modeled on SRAM. The model counts block reads,
+ *  page write cycles and acknowledge polls, and it records any access while a write
+ *  cycle is in progress and any write crossing a page of the device.
+ */
+
+#include "Arduino.h"
+
+/// Page-oriented external EEPROM on SRAM (1 KB, 64 byte pages, busy for 3 polls after each write cycle)
+#define DEVICE_SIZE 1024
+#define DEVICE_PAGE 64
+#define DEVICE_LOG 16
+
+struct T_DEVICE
+{
+	uint8_t data[DEVICE_SIZE];
+	unsigned int reads;                 ///< Block read transactions
+	unsigned int writes;                ///< Page write cycles
+	unsigned int polls;                 ///< Acknowledge polls
+	unsigned int violations;            ///< Accesses during a write cycle or writes across a page
+	uint8_t busy;                       ///< Polls left to the end of the write cycle
+	int address[DEVICE_LOG];            ///< First address of the latest write cycles
+	unsigned int size[DEVICE_LOG];      ///< Bytes of the latest write cycles
+} device;
+
+void device_read(int address, uint8_t *data, unsigned int size)
+{
+	if (device.busy) device.violations++;
+
+	memcpy(data, device.data + address, size);
+	device.reads++;
+}
+
+void device_write(int address, const uint8_t *data, unsigned int size)
+{
+	if (device.busy) device.violations++;
+	if (address/DEVICE_PAGE != (address + (int) size - 1)/DEVICE_PAGE) device.violations++;
+
+	memcpy(device.data + address, data, size);
+	if (device.writes < DEVICE_LOG)
+	{
+		device.address[device.writes] = address;
+		device.size[device.writes] = size;
+	}
+	device.writes++;
+	device.busy = 3;
+}
+
+bool device_ready()
+{
+	device.polls++;
+	if (device.busy) device.busy--;
+
+	return (!device.busy);
+}
+
+/// Reset the counters of the device, completing any write cycle
+void device_reset()
+{
+	device.reads = 0;
+	device.writes = 0;
+	device.polls = 0;
+	device.violations = 0;
+	device.busy = 0;
+}
+
+#define XEEPROM_END (DEVICE_SIZE - 1)
+#define XEEPROM_PAGE_SIZE 16
+#define XEEPROM_READAHEAD 16
+#define XEEPROM_READ_BLOCK(address, data, size) device_read(address, (uint8_t *) (data), size)
+#define XEEPROM_WRITE_PAGE(address, data, size) device_write(address, data, size)
+#define XEEPROM_READY() device_ready()
+
+#include "XTable.h"
+#include "ArduinoUnit.h"
+
+
+/// XTable item structure definition (this data tyepe is part of BlinkingLEDs Project)
+struct T_LED
+{
+	unsigned char pin;
+	bool blinking;
+	unsigned long delay_ms;
+} LED;
+
+XEEPROM<uint8_t> ext_eeprom;
+
+/// Device filled with the low byte of each address and window moved away from any tested location
+void SamplePattern()
+{
+	ext_eeprom.Flush();
+	for (int j=0; j<DEVICE_SIZE; j++) device.data[j] = j & 0xFF;
+	ext_eeprom.read(DEVICE_SIZE - 1);
+	device_reset();
+}
+
+
+test(ReadaheadWindow)
+{
+	XEEPROM<uint8_t> other;
+
+	SamplePattern();
+
+	/// A single block read for the whole window
+	for (int j=100; j<116; j++) assertEqual(ext_eeprom.read(j), j);
+	assertEqual(device.reads, 1);
+
+	/// Both edges of the window move it
+	assertEqual(ext_eeprom.read(116), 116);
+	assertEqual(device.reads, 2);
+	assertEqual(ext_eeprom.read(115), 115);
+	assertEqual(device.reads, 3);
+
+	/// Window shared by all instances
+	assertEqual(other.read(120), 120);
+	assertEqual(device.reads, 3);
+
+	/// Window cut at the end of the EEPROM
+	assertEqual(ext_eeprom.read(DEVICE_SIZE - 4), (DEVICE_SIZE - 4) & 0xFF);
+	assertEqual(ext_eeprom.read(DEVICE_SIZE - 1), (DEVICE_SIZE - 1) & 0xFF);
+	assertEqual(device.reads, 4);
+	assertEqual(device.violations, 0);
+}
+
+test(ReadaheadWrites)
+{
+	XEEPROM<uint8_t> other;
+
+	SamplePattern();
+	assertEqual(other.read(200), 200);
+	assertEqual(device.reads, 1);
+
+	/// Written bytes read back from the window before and after the page write
+	ext_eeprom.write(205, 0xA5);
+	ext_eeprom.erase(206);
+	ext_eeprom.program(206, 0x0F);
+	assertEqual(other.read(205), 0xA5);
+	assertEqual(other.read(206), 0x0F);
+	assertEqual(device.data[205], 205);
+	ext_eeprom.Flush();
+	assertEqual(device.data[205], 0xA5);
+	assertEqual(device.data[206], 0x0F);
+	assertEqual(other.read(205), 0xA5);
+	assertEqual(device.reads, 1);
+
+	/// Bytes still pending override the device when the window moves onto them
+	ext_eeprom.write(300, 0x5A);
+	assertEqual(other.read(298), 298 & 0xFF);
+	assertEqual(other.read(300), 0x5A);
+	assertEqual(device.data[300], 300 & 0xFF);
+	assertEqual(device.reads, 2);
+
+	/// The write cycle in progress is polled before the next block read
+	ext_eeprom.Flush();
+	assertEqual(other.read(400), 400 & 0xFF);
+	assertEqual(device.writes, 2);
+	assertEqual(device.polls, 6);
+	assertEqual(device.violations, 0);
+}
+
+test(PageWrite)
+{
+	uint8_t value[12];
+
+	SamplePattern();
+
+	/// Consecutive bytes across a page boundary: one write cycle for each page
+	for (int j=0; j<12; j++) value[j] = 0xC0 + j;
+	ext_eeprom.Update(508, value, 12);
+	assertEqual(device.writes, 1);
+	ext_eeprom.Flush();
+	assertEqual(device.writes, 2);
+	assertEqual(device.address[0], 508);
+	assertEqual(device.size[0], 4);
+	assertEqual(device.address[1], 512);
+	assertEqual(device.size[1], 8);
+	for (int j=504; j<524; j++) assertEqual(device.data[j], ((j>=508) && (j<520) ? 0xC0 + j - 508 : j & 0xFF));
+
+	/// Unchanged bytes are not written at all
+	ext_eeprom.Update(508, value, 12);
+	ext_eeprom.Flush();
+	assertEqual(device.writes, 2);
+
+	/// Bytes between written ones are read back first, so a single cycle covers them
+	device_reset();
+	ext_eeprom.write(33, 1);
+	ext_eeprom.write(40, 2);
+	ext_eeprom.Flush();
+	assertEqual(device.writes, 1);
+	assertEqual(device.address[0], 33);
+	assertEqual(device.size[0], 8);
+	assertEqual(device.reads, 1);
+	for (int j=32; j<48; j++) assertEqual(device.data[j], (j == 33 ? 1 : (j == 40 ? 2 : j)));
+	assertEqual(device.violations, 0);
+}
+
+test(PageWriteStorage)
+{
+	XTable<T_LED> table;
+	uint8_t before[DEVICE_SIZE];
+	unsigned int pages;
+
+	assertTrue(table.InitBuffer(10));
+	for (int id=0; id<4; id++)
+	{
+		LED.pin = id+2;
+		LED.blinking = true;
+		LED.delay_ms = 100*(id+1);
+		assertTrue(table.Insert(LED));
+	}
+
+	/// Parameter buffer across several pages
+	ext_eeprom.Fill(500, table.SizeStorage(10), 0);
+	ext_eeprom.Flush();
+	assertTrue(table.InitStorage(500, 10));
+	ext_eeprom.Flush();
+	memcpy(before, device.data, DEVICE_SIZE);
+	device_reset();
+
+	assertTrue(table.SaveStorage());
+
+	/// One write cycle for each changed page, but the counter written after the items into the page of the first one
+	pages = 0;
+	for (int j=0; j<DEVICE_SIZE; j+=XEEPROM_PAGE_SIZE)
+		if (memcmp(before + j, device.data + j, XEEPROM_PAGE_SIZE)) pages++;
+	assertMore(pages, 2);
+	assertEqual(device.writes, pages + 1);
+	for (unsigned int k=0; k<device.writes; k++)
+		assertEqual(device.address[k]/XEEPROM_PAGE_SIZE, (device.address[k] + device.size[k] - 1)/XEEPROM_PAGE_SIZE);
+	assertEqual(device.violations, 0);
+
+	/// Stored items read back through the window
+	table.Clean();
+	assertTrue(table.LoadStorage());
+	assertEqual(table.Counter(), 4);
+	assertTrue(table.Top());
+	for (int id=0; id<4; id++)
+	{
+		assertEqual(table.Select()->pin, id+2);
+		assertEqual(table.Select()->delay_ms, 100*(id+1));
+		table.Next();
+	}
+}
+
+
+
+int main(int argc, char *argv[]) {
+	init();
+
+	/// Init serial communications and wait for port to open:
+	Serial.begin(115200);
+
+	/// Wait for serial port to connect (this is an optional condition board related)
+	while (!Serial);
+	delay(50);
+
+	Serial.println("Test XEEPROM Arduino Class");
+	Test::min_verbosity = TEST_VERBOSITY_NONE;
+
+	Test::exclude("*");
+	Test::include("ReadaheadWindow");
+	Test::include("ReadaheadWrites");
+	Test::include("PageWrite");
+	Test::include("PageWriteStorage");
+
+	while(1) Test::run();
+
+	delay(200);
+	exit(0);
+}
@@ -0,0 +1,290 @@
+/********************************************************************************
+ *   TestXFlash - Unit Test for XFlashTable Class                               *
+ *   Copyright (C) 2015 by AF                                    				        *
+ *                                                                              *
+ *   This file is part of XDAQ Virtual Appliance                                *
+ *   (see more on www.embeddedrevolution.info).                                 *
+ *                                                                              *
+ *   TestXFlash is free software: you can redistribute it and/or modify it      *
+ *   under the terms of the GNU Lesser General Public License as published      *
+ *   by the Free Software Foundation, either version 3 of the License, or       *
+ *   (at your option) any later version.                                        *
+ *                                                                              *
+ *   TestXFlash is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ *   GNU Lesser General Public License for more details.                        *
+ *                                                                              *
+ *   You should have received a copy of the GNU Lesser General Public           *
+ *   License along with TestXFlash. If not, see <http:///www.gnu.org/licenses/> *
+ ********************************************************************************/
+
+/**
+ *  @file    TestXFlash.cpp (or TestXFlash.ino)
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *	@brief Unit Test application for XFlashTable log-structured storage
+ *
+ *  @section DESCRIPTION
+ *
+ *  This unit test runs XFlashTable on a NOR flash modeled on SRAM. The model
+ *  enforces erase-before-write (programming can move bits from 1 to 0 only),
+ *  counts the erases of each sector and the bytes programmed twice between
+ *  erases, and can lose power after a given number
+ *  of programmed bytes, ignoring any further program or erase as a device
+ *  switched off would do.
+ */
+
+#include "Arduino.h"
+
+/// NOR flash on SRAM (4 sectors of 128 bytes)
+#define FLASH_SECTOR 128
+#define FLASH_SECTORS 4
+
+struct T_FLASH
+{
+	uint8_t data[FLASH_SECTOR*FLASH_SECTORS];
+	unsigned int erases[FLASH_SECTORS];     ///< Erases of each sector
+	unsigned int programs;                  ///< Programmed bytes
+	unsigned int violations;                ///< Bits programmed from 0 to 1 or erases out of a sector boundary
+	unsigned int reprograms;                ///< Bytes programmed twice between erases
+	uint8_t programmed[FLASH_SECTOR*FLASH_SECTORS/8];
+	int budget;                             ///< Programmed bytes before the power loss (-1 for none)
+} flash;
+
+void flash_read(unsigned long address, uint8_t *data, unsigned int size)
+{
+	memcpy(data, flash.data + address, size);
+}
+
+void flash_program(unsigned long address, const uint8_t *data, unsigned int size)
+{
+	for (unsigned int j=0; j<size; j++)
+	{
+		if (!flash.budget) return;
+		if (flash.budget > 0) flash.budget--;
+
+		if ((flash.data[address + j] & data[j]) != data[j]) flash.violations++;
+		if (flash.programmed[(address + j)/8] & (1 << ((address + j)%8))) flash.reprograms++;
+		flash.programmed[(address + j)/8] |= (1 << ((address + j)%8));
+		flash.data[address + j] &= data[j];
+		flash.programs++;
+	}
+}
+
+void flash_erase(unsigned long address)
+{
+	if (!flash.budget) return;
+	if (address % FLASH_SECTOR) flash.violations++;
+
+	memset(flash.data + address - address % FLASH_SECTOR, 0xFF, FLASH_SECTOR);
+	memset(flash.programmed + (address - address % FLASH_SECTOR)/8, 0, FLASH_SECTOR/8);
+	flash.erases[address/FLASH_SECTOR]++;
+}
+
+/// Flash as shipped (not erased) and counters reset
+void flash_reset()
+{
+	memset(flash.data, 0x5A, sizeof(flash.data));
+	memset(flash.erases, 0, sizeof(flash.erases));
+	memset(flash.programmed, 0, sizeof(flash.programmed));
+	flash.programs = 0;
+	flash.violations = 0;
+	flash.reprograms = 0;
+	flash.budget = -1;
+}
+
+#define XFLASH_SECTOR_SIZE FLASH_SECTOR
+#define XFLASH_READ(address, data, size) flash_read(address, (uint8_t *) (data), size)
+#define XFLASH_PROGRAM(address, data, size) flash_program(address, (const uint8_t *) (data), size)
+#define XFLASH_ERASE(address) flash_erase(address)
+
+#include "XFlash.h"
+#include "ArduinoUnit.h"
+
+
+/// XTable item structure definition (this data tyepe is part of BlinkingLEDs Project)
+struct T_LED
+{
+	unsigned char pin;
+	bool blinking;
+	unsigned long delay_ms;
+} LED;
+
+/// Portable encoding of the item structure (see XRecord.h)
+#define T_LED_FIELDS(F) F(pin, 1) F(blinking, 1) F(delay_ms, 4)
+XRECORD(T_LED, T_LED_FIELDS)
+
+/// Snapshot of 5 items: 3 + 5*6 bytes, 3 of them for each sector
+#define SAMPLE_ITEMS 5
+#define SAMPLES_PER_SECTOR 3
+
+/// Collection of items of the given sample
+bool PutSample(XFlashTable<T_LED> &table, unsigned long sample)
+{
+	table.Clean();
+	for (int id=0; id<SAMPLE_ITEMS; id++)
+	{
+		LED.pin = id+2;
+		LED.blinking = (id & 1);
+		LED.delay_ms = sample*100 + id;
+		if (!table.Insert(LED)) return false;
+	}
+
+	return true;
+}
+
+/// Collection of items stored last, as found by a table started from scratch
+bool IsSample(unsigned long sample)
+{
+	XFlashTable<T_LED> table;
+	int id = 0;
+
+	if ((!table.InitBuffer(10)) || (!table.InitStorage(0, FLASH_SECTORS)) || (!table.LoadStorage())) return false;
+	if (table.Counter() != SAMPLE_ITEMS) return false;
+
+	for (bool found = table.Top(); found; found = table.Next(), id++)
+		if ((table.Select()->pin != id+2) || (table.Select()->delay_ms != sample*100 + id)) return false;
+
+	return (id == SAMPLE_ITEMS);
+}
+
+
+test(FlashModel)
+{
+	uint8_t value = 0x0F;
+
+	/// Programming sets bits back to 1 only through an erase
+	flash_reset();
+	flash_erase(0);
+	flash_program(10, &value, 1);
+	assertEqual(flash.violations, 0);
+	value = 0xF0;
+	flash_program(10, &value, 1);
+	assertEqual(flash.violations, 1);
+	assertEqual(flash.reprograms, 1);
+	assertEqual(flash.data[10], 0x00);
+	flash_erase(10);
+	assertEqual(flash.violations, 2);
+}
+
+test(EraseBeforeWrite)
+{
+	XFlashTable<T_LED> table;
+
+	flash_reset();
+	assertTrue(table.InitBuffer(10));
+	assertTrue(table.InitStorage(0, FLASH_SECTORS));
+	assertFalse(table.LoadStorage());
+
+	/// First sector erased once before its header is programmed
+	assertEqual(flash.erases[0], 1);
+	for (int sector=1; sector<FLASH_SECTORS; sector++) assertEqual(flash.erases[sector], 0);
+
+	/// Snapshots appended to the erased space: no byte programmed twice
+	for (unsigned long sample=1; sample<=SAMPLES_PER_SECTOR; sample++)
+	{
+		assertTrue(PutSample(table, sample));
+		assertTrue(table.SaveStorage());
+		assertTrue(IsSample(sample));
+	}
+	assertEqual(flash.erases[0], 1);
+	assertEqual(flash.violations, 0);
+	assertEqual(flash.reprograms, 0);
+
+	/// Unchanged collection not programmed again
+	flash.programs = 0;
+	assertTrue(table.SaveStorage());
+	assertEqual(flash.programs, 0);
+}
+
+test(SectorRotation)
+{
+	XFlashTable<T_LED> table;
+	unsigned long sample;
+
+	flash_reset();
+	assertTrue(table.InitBuffer(10));
+	assertTrue(table.InitStorage(0, FLASH_SECTORS));
+
+	/// Each full sector moves the log to the following one, erasing it
+	for (sample=1; sample<=SAMPLES_PER_SECTOR*FLASH_SECTORS; sample++)
+	{
+		assertTrue(PutSample(table, sample));
+		assertTrue(table.SaveStorage());
+	}
+	for (int sector=0; sector<FLASH_SECTORS; sector++) assertEqual(flash.erases[sector], 1);
+
+	/// The oldest sector erased again once the log wraps around
+	assertTrue(PutSample(table, sample));
+	assertTrue(table.SaveStorage());
+	assertEqual(flash.erases[0], 2);
+	assertEqual(flash.erases[1], 1);
+	assertEqual(flash.violations, 0);
+	assertTrue(IsSample(sample));
+}
+
+test(InterruptedSnapshot)
+{
+	XFlashTable<T_LED> table;
+	/// Sector header, snapshot header (commit byte left erased), items and commit byte
+	unsigned int length = 8 + 2 + SAMPLE_ITEMS*XRecord<T_LED>::Size + 1;
+
+	flash_reset();
+	assertTrue(table.InitBuffer(10));
+	assertTrue(table.InitStorage(0, FLASH_SECTORS));
+	assertTrue(PutSample(table, 1));
+	assertTrue(table.SaveStorage());
+
+	/// Power lost at each programmed byte of the following save, up to the commit byte:
+	/// the previous collection is found after the restart
+	for (unsigned int cut=0; cut<length; cut++)
+	{
+		XFlashTable<T_LED> other;
+
+		assertTrue(other.InitBuffer(10));
+		assertTrue(other.InitStorage(0, FLASH_SECTORS));
+		assertTrue(PutSample(other, cut + 2));
+		flash.budget = cut;
+		assertFalse(other.SaveStorage());
+		flash.budget = -1;
+		assertTrue(IsSample(1));
+	}
+
+	/// The log goes on beyond the interrupted snapshots
+	assertTrue(table.InitStorage(0, FLASH_SECTORS));
+	assertTrue(PutSample(table, 99));
+	assertTrue(table.SaveStorage());
+	assertTrue(IsSample(99));
+	assertEqual(flash.violations, 0);
+	assertEqual(flash.reprograms, 0);
+}
+
+
+
+int main(int argc, char *argv[]) {
+	init();
+
+	/// Init serial communications and wait for port to open:
+	Serial.begin(115200);
+
+	/// Wait for serial port to connect (this is an optional condition board related)
+	while (!Serial);
+	delay(50);
+
+	Serial.println("Test XFlash Arduino Class");
+	Test::min_verbosity = TEST_VERBOSITY_NONE;
+
+	Test::exclude("*");
+	Test::include("FlashModel");
+	Test::include("EraseBeforeWrite");
+	Test::include("SectorRotation");
+	Test::include("InterruptedSnapshot");
+
+	while(1) Test::run();
+
+	delay(200);
+	exit(0);
+}
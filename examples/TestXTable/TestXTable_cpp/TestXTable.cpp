@@ -34,16 +34,48 @@
  *  configuration purpose, with CRUD API approach (Create, Read, Update and Delete).
  *  It manages generic structured items through an efficient storage using a
  *  circular buffer in EEPROM and volatile SRAM.
+ *
+ *  Storage operations run on an EEPROM modeled on SRAM by default, so that the
+ *  whole test wears no EEPROM location. CHECK_STORAGE_OPERATIONS set to 1 runs
+ *  them on the EEPROM of the board.
  */
 
+#include "Arduino.h"
+
+#define CHECK_STORAGE_OPERATIONS 0
+
+#if CHECK_STORAGE_OPERATIONS==0
+/// EEPROM on SRAM through the hooks of a page-oriented device (see XEEPROM_PAGE_SIZE):
+/// 512 bytes, twice as much where items are larger (long wider than 32 bit)
+#define MODEL_SIZE (sizeof(long) > 4 ? 1024 : 512)
+uint8_t model[MODEL_SIZE];
+
+void model_read(int address, uint8_t *data, unsigned int size)
+{
+	memcpy(data, model + address, size);
+}
+
+void model_write(int address, const uint8_t *data, unsigned int size)
+{
+	memcpy(model + address, data, size);
+}
+
+#define XEEPROM_END (MODEL_SIZE - 1)
+#define XEEPROM_PAGE_SIZE 16
+#define XEEPROM_READ_BLOCK(address, data, size) model_read(address, (uint8_t *) (data), size)
+#define XEEPROM_WRITE_PAGE(address, data, size) model_write(address, data, size)
+#define XEEPROM_READY() true
+#endif
+
 #include "XTable.h"
+#include "XDirectory.h"
+#include "XLayout.h"
 #include "ArduinoUnit.h"
 
 #define DEBUG(value) Serial.print("\n"); Serial.print(__LINE__); Serial.print(":"); Serial.print(#value); Serial.print("="); Serial.println(value);
 
 
 #define MAX_NUM_ITEMS 30
-#define CHECK_STORAGE_OPERATIONS 0
 
 /// XTable item structure definition (this data tyepe is part of BlinkingLEDs Project)
 struct T_LED
@@ -53,11 +85,26 @@ struct T_LED
 	unsigned long delay_ms;
 } LED;
 
+/// Portable encoding of the item structure (see XRecord.h)
+#define T_LED_FIELDS(F) F(pin, 1) F(blinking, 1) F(delay_ms, 4)
+XRECORD(T_LED, T_LED_FIELDS)
+
 XTable<T_LED> blinking_LEDs;
 
+/// Default items on flash
+const T_LED default_LEDs[] PROGMEM = { { 2, false, 500 }, { 3, false, 500 }, { 4, true, 100 }, { 5, true, 100 } };
+
+/// Runtime list kept across soft resets
+XTable<T_LED>::Resident<10> resident_LEDs __attribute__((section(".noinit")));
+
+/// Previous version of the item structure (schema 1)
+struct T_LED_V1
+{
+	unsigned char pin;
+	bool blinking;
+};
 
 
-#if CHECK_STORAGE_OPERATIONS==0
 
 void InsertSample()
 {
@@ -228,7 +275,147 @@ test(Next)
 
 }
 
-#else
+test(Defaults)
+{
+	XTable<T_LED> table;
+	XTable<T_LED> small;
+	unsigned char pins[] = { 2, 3, 5, 9 };
+	int id;
+
+	assertTrue(table.InitBuffer(6));
+	assertTrue(table.InitDefaults(default_LEDs, 4));
+	assertEqual(table.Counter(), 4);
+	assertTrue(table.Top());
+	assertEqual(table.Select()->pin, 2);
+
+	/// Updated default items are copied to SRAM and keep their position
+	assertTrue(table.Next());
+	LED = *table.Select();
+	LED.delay_ms = 1234;
+	assertTrue(table.Update(LED));
+	assertTrue(table.Next());
+	assertTrue(table.Delete());
+	assertTrue(table.Top());
+	assertTrue(table.Next());
+	assertEqual(table.Select()->delay_ms, 1234);
+
+	LED.pin = 9;
+	assertTrue(table.Insert(LED));
+	assertEqual(table.Counter(), 4);
+
+	id = 0;
+	assertTrue(table.Top());
+	do assertEqual(table.Select()->pin, pins[id++]);
+	while (table.Next());
+	assertEqual(id, 4);
+
+	/// Default items need no slot until updated or stored
+	assertTrue(small.InitBuffer(2));
+	assertTrue(small.InitDefaults(default_LEDs, 4));
+	assertTrue(small.Top());
+	assertTrue(small.Next());
+	assertTrue(small.Next());
+	assertTrue(small.Next());
+	assertEqual(small.Select()->pin, 5);
+}
+
+test(Handles)
+{
+	XTable<T_LED> table;
+	XTable<T_LED>::Handle handles[4];
+	XTable<T_LED>::Handle handle;
+	int id;
+
+	assertTrue(table.InitBuffer(4));
+	for (id=0; id<4; id++)
+	{
+		LED.pin = id + 2;
+		assertTrue(table.Insert(LED, &handles[id]));
+		assertTrue(handles[id] != 0);
+	}
+	assertFalse(table.Insert(LED, &handle));
+
+	/// Handles do not move current table position
+	assertTrue(table.Top());
+	assertTrue(table.Next());
+	assertEqual(table.Select(handles[3])->pin, 5);
+	LED.pin = 9;
+	assertTrue(table.Update(handles[2], LED));
+	assertTrue(table.Delete(handles[0]));
+	assertEqual(table.Counter(), 3);
+	assertEqual(table.Select()->pin, 3);
+	assertTrue(table.Next());
+	assertEqual(table.Select()->pin, 9);
+
+	/// Deleted slot reused with a different generation
+	assertTrue(table.Select(handles[0]) == NULL);
+	assertFalse(table.Update(handles[0], LED));
+	assertFalse(table.Delete(handles[0]));
+	assertTrue(table.Insert(LED, &handle));
+	assertTrue(handle != handles[0]);
+	assertEqual(table.Select(handle)->pin, 9);
+
+	/// Cursor operations retire handles as well
+	assertTrue(table.Top());
+	assertTrue(table.Delete());
+	assertTrue(table.Select(handle) == NULL);
+
+	table.Clean();
+	assertTrue(table.Select(handles[1]) == NULL);
+	assertEqual(table.Counter(), 0);
+}
+
+test(Positions)
+{
+	XTable<T_LED> table;
+	unsigned int id;
+
+	assertTrue(table.InitBuffer(20));
+	for (id=0; id<20; id++)
+	{
+		LED.pin = id;
+		assertTrue(table.Insert(LED));
+	}
+	assertEqual(table.At(7)->pin, 7);
+	assertTrue(table.At(20) == NULL);
+
+	/// Holes: positions follow Top and Next
+	assertTrue(table.Seek(3));
+	assertTrue(table.Delete());
+	assertTrue(table.Seek(10));
+	assertTrue(table.Delete());
+	assertTrue(table.Seek(15));
+	assertTrue(table.Delete());
+	assertEqual(table.Counter(), 17);
+
+	id = 0;
+	assertTrue(table.Top());
+	do assertEqual(table.At(id++)->pin, table.Select()->pin);
+	while (table.Next());
+	assertEqual(id, 17);
+	assertTrue(table.At(17) == NULL);
+
+	/// At does not move current table position
+	assertTrue(table.Seek(12));
+	assertEqual(table.Select()->pin, 14);
+	assertEqual(table.At(16)->pin, 19);
+	assertEqual(table.Select()->pin, 14);
+
+	/// Slots back in use
+	LED.pin = 3;
+	assertTrue(table.Insert(LED));
+	assertEqual(table.At(3)->pin, 3);
+	assertEqual(table.At(17)->pin, 19);
+	assertFalse(table.Seek(18));
+
+	/// Default items come first
+	assertTrue(table.InitDefaults(default_LEDs, 4));
+	LED.pin = 9;
+	assertTrue(table.Insert(LED));
+	assertEqual(table.At(1)->pin, 3);
+	assertEqual(table.At(4)->pin, 9);
+	assertTrue(table.At(5) == NULL);
+}
 
 test(InitStorage)
 {
@@ -272,6 +459,68 @@ test(SaveStorage)
 	assertEqual(LED.pin, 10);
 }
 
+test(SavePolicy)
+{
+	int top;
+	unsigned long avoided;
+
+	SaveSampleStorage(88, 10);
+	top = blinking_LEDs.GetTopAddressStorage();
+
+	/// Window of 1 sec, 2 storing operations for each minute
+	blinking_LEDs.SetSavePolicy(1000, 2, 60000);
+
+	/// Requests within the window coalesced into a single storing operation
+	assertFalse(blinking_LEDs.RequestSave(0));
+	assertFalse(blinking_LEDs.RequestSave(500));
+	assertEqual(blinking_LEDs.GetTopAddressStorage(), top);
+	assertTrue(blinking_LEDs.FlushStorage(1000));
+	assertEqual(blinking_LEDs.GetTopAddressStorage(), top + (int) sizeof(*blinking_LEDs.xitem));
+	assertEqual(blinking_LEDs.AvoidedSaves(), 1);
+
+	/// Third storing operation of the same minute waits for the next one
+	assertFalse(blinking_LEDs.RequestSave(5000));
+	assertTrue(blinking_LEDs.FlushStorage(6000));
+	assertFalse(blinking_LEDs.RequestSave(10000));
+	assertFalse(blinking_LEDs.FlushStorage(20000));
+	assertTrue(blinking_LEDs.FlushStorage(61000));
+
+	/// Forced storing operation
+	assertFalse(blinking_LEDs.RequestSave(62000));
+	assertTrue(blinking_LEDs.FlushStorage());
+	assertTrue(blinking_LEDs.FlushStorage(70000));
+
+	/// Unchanged table already stored (see SNAPSHOT_HASH): avoided and not charged to the budget
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.SNAPSHOT_HASH));
+	assertTrue(blinking_LEDs.SaveStorage());
+	blinking_LEDs.SetSavePolicy(0, 1, 60000);
+	avoided = blinking_LEDs.AvoidedSaves();
+	assertTrue(blinking_LEDs.RequestSave(100000));
+	assertTrue(blinking_LEDs.RequestSave(100500));
+	assertEqual(blinking_LEDs.AvoidedSaves(), avoided + 2);
+
+	/// Failed storing operation retried at the next call
+	blinking_LEDs.eeprom.write(88, 0);
+	blinking_LEDs.eeprom.Flush();
+	assertFalse(blinking_LEDs.RequestSave(101000));
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.SNAPSHOT_HASH));
+	assertTrue(blinking_LEDs.FlushStorage(102000));
+
+	/// Budget charged by the written one only
+	assertTrue(blinking_LEDs.Top());
+	LED = *blinking_LEDs.Select();
+	LED.delay_ms++;
+	assertTrue(blinking_LEDs.Update(LED));
+	assertFalse(blinking_LEDs.RequestSave(103000));
+	assertEqual(blinking_LEDs.AvoidedSaves(), avoided + 2);
+
+	blinking_LEDs.SetSavePolicy(0);
+	assertTrue(blinking_LEDs.FlushStorage(104000));
+	assertTrue(blinking_LEDs.RequestSave(0));
+	assertEqual(blinking_LEDs.AvoidedSaves(), avoided + 3);
+}
+
 test(LoadStorage)
 {
 	unsigned char id;
@@ -296,6 +545,582 @@ test(LoadStorage)
 	assertFalse(blinking_LEDs.LoadStorage());
 }
 
+test(PreEraseStorage)
+{
+	unsigned char id;
+
+	SaveSampleStorage(88, 10);
+
+#if XEEPROM_SPLIT_CYCLES
+	/// Erase next storing locations and store again
+	assertTrue(blinking_LEDs.PreEraseStorage());
+#else
+	/// Nothing erased in advance without erase-only cycles
+	assertFalse(blinking_LEDs.PreEraseStorage());
+#endif
+	assertTrue(blinking_LEDs.SaveStorage());
+
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 10);
+
+	assertTrue(blinking_LEDs.Top());
+	id=10;
+	do
+	{
+		assertEqual(blinking_LEDs.Select()->pin, id--);
+	} while (blinking_LEDs.Next());
+
+	blinking_LEDs.eeprom.Fill(88, 100, 0);
+	assertFalse(blinking_LEDs.PreEraseStorage());
+}
+
+test(BitClearStatus)
+{
+	unsigned int id;
+
+	SaveSampleStorage(88, 10);
+
+	/// Extended header: marker, max number of items and storage mode
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.BITCLEAR_STATUS));
+	assertEqual(blinking_LEDs.eeprom.read(88), blinking_LEDs.XMK);
+	assertEqual(blinking_LEDs.eeprom.read(88+1), 10);
+	assertEqual(blinking_LEDs.eeprom.read(88+2), blinking_LEDs.BITCLEAR_STATUS);
+	assertEqual(blinking_LEDs.eeprom.read(88+2*10+3), blinking_LEDs.EMK);
+
+	/// Store 11 times data on buffer: second round starts from the first location.
+	/// Each status update moves bits from 1 to 0 only, a write-only cycle with XEEPROM_SPLIT_CYCLES.
+	for (id=0; id<11; id++) assertTrue(blinking_LEDs.SaveStorage());
+	assertEqual(blinking_LEDs.GetTopAddressStorage(), 88 + 2*10 + 4);
+	assertEqual(blinking_LEDs.eeprom.read(88+3), 0x7F);
+	assertEqual(blinking_LEDs.eeprom.read(88+5), 0xFF);
+
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 10);
+}
+
+test(WearReport)
+{
+	unsigned int id;
+	XTable<T_LED>::WearInfo report;
+
+	SaveSampleStorage(88, 10);
+	assertFalse(blinking_LEDs.WearReport(&report));
+
+	blinking_LEDs.eeprom.Fill(88, 100, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 5, blinking_LEDs.BITCLEAR_STATUS | blinking_LEDs.WEAR_TELEMETRY));
+	assertEqual(blinking_LEDs.NextFreeAddressStorage(), 88 + blinking_LEDs.SizeStorage(5, blinking_LEDs.BITCLEAR_STATUS | blinking_LEDs.WEAR_TELEMETRY));
+	assertTrue(blinking_LEDs.WearReport(&report));
+	assertEqual(report.saves, 0);
+	assertEqual(report.max_cycles, 0);
+
+	/// Store 7 times 3 items on a buffer of 5 locations: more than one round
+	blinking_LEDs.Clean();
+	for (id=0; id<3; id++) assertTrue(blinking_LEDs.Insert(LED));
+	for (id=0; id<7; id++) assertTrue(blinking_LEDs.SaveStorage());
+
+	assertTrue(blinking_LEDs.WearReport(&report));
+	assertEqual(report.saves, 7);
+	assertEqual(report.items, 7*3);
+	assertEqual(report.bytes, 7*3*sizeof(*blinking_LEDs.xitem) + 7*2);
+	assertEqual(report.max_cycles, (7*3 + 4)/5);
+	assertTrue(report.remaining_saves <= (XEEPROM_ENDURANCE - 5)*7/5);
+	assertTrue(report.remaining_saves + (XEEPROM_ENDURANCE - 5)/256 + 1 >= (XEEPROM_ENDURANCE - 5)*7/5);
+
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 3);
+
+	/// A patch is a single written item
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.WEAR_TELEMETRY | blinking_LEDs.DELTA_SNAPSHOTS));
+	assertTrue(blinking_LEDs.SaveStorage());
+	assertTrue(blinking_LEDs.Top());
+	LED = *blinking_LEDs.Select();
+	LED.delay_ms++;
+	assertTrue(blinking_LEDs.Update(LED));
+	assertTrue(blinking_LEDs.SaveStorage());
+
+	assertTrue(blinking_LEDs.WearReport(&report));
+	assertEqual(report.saves, 2);
+	assertEqual(report.items, 3 + 1);
+	assertEqual(report.bytes, 4*sizeof(*blinking_LEDs.xitem) + 2*(2 + 1));
+}
+
+test(SnapshotHash)
+{
+	int top;
+
+	SaveSampleStorage(88, 10);
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.SNAPSHOT_HASH));
+	assertEqual(blinking_LEDs.NextFreeAddressStorage(), 88 + blinking_LEDs.SizeStorage(10, blinking_LEDs.SNAPSHOT_HASH));
+	assertTrue(blinking_LEDs.SaveStorage());
+	top = blinking_LEDs.GetTopAddressStorage();
+
+	/// Unchanged table is not stored again, even after a new start
+	assertTrue(blinking_LEDs.SaveStorage());
+	assertEqual(blinking_LEDs.GetTopAddressStorage(), top);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.SNAPSHOT_HASH));
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertTrue(blinking_LEDs.SaveStorage());
+	assertEqual(blinking_LEDs.GetTopAddressStorage(), top);
+
+	/// Any change is stored
+	assertTrue(blinking_LEDs.Top());
+	LED = *blinking_LEDs.Select();
+	LED.delay_ms++;
+	assertTrue(blinking_LEDs.Update(LED));
+	assertTrue(blinking_LEDs.SaveStorage());
+	assertEqual(blinking_LEDs.GetTopAddressStorage(), top + (int) sizeof(*blinking_LEDs.xitem));
+
+	assertTrue(blinking_LEDs.Delete());
+	assertTrue(blinking_LEDs.SaveStorage());
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 9);
+}
+
+bool MigrateLED(uint8_t version, XTable<T_LED>::XItem<T_LED> *record, unsigned int size)
+{
+	XTable<T_LED_V1>::XItem<T_LED_V1> stored;
+
+	if ((version != 1) || (size != sizeof(stored))) return false;
+
+	memcpy(&stored, record, size);
+	record->item.pin = stored.item.pin;
+	record->item.blinking = stored.item.blinking;
+	record->item.delay_ms = 1000;
+
+	return true;
+}
+
+/// Migration of encoded items: stored fields are already decoded, appended ones are 0
+bool MigrateLEDFields(uint8_t version, XTable<T_LED>::XItem<T_LED> *record, unsigned int size)
+{
+	if ((version != 1) || (record->item.delay_ms != 0)) return false;
+
+	record->item.delay_ms = 1000;
+
+	return true;
+}
+
+test(SchemaMigration)
+{
+	unsigned char id;
+	T_LED_V1 led;
+	XTable<T_LED_V1> previous;
+	XTable<T_LED> table;
+
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+
+	/// Items stored by the previous version of the sketch
+	assertTrue(previous.InitBuffer(10));
+	previous.SetSchema(1);
+	for (id=0; id<5; id++)
+	{
+		led.pin = id+2;
+		led.blinking = true;
+		assertTrue(previous.Insert(led));
+	}
+	assertTrue((previous.InitStorage(88, 10, XTable<T_LED_V1>::SCHEMA_VERSION)));
+	assertTrue(previous.SaveStorage());
+
+	/// Different schema cannot be copied as it is
+	assertTrue(table.InitBuffer(10));
+	table.SetSchema(2);
+	assertTrue((table.InitStorage(88, 10, XTable<T_LED>::SCHEMA_VERSION)));
+	assertFalse(table.LoadStorage());
+
+	/// Items upgraded while loading
+	table.SetSchema(2, MigrateLED);
+	assertTrue(table.LoadStorage());
+	assertEqual(table.Counter(), 5);
+	assertTrue(table.Top());
+	assertEqual(table.Select()->pin, 2);
+	assertEqual(table.Select()->delay_ms, 1000);
+
+	/// Stored again with current schema
+	assertTrue(table.SaveStorage());
+	table.SetSchema(2);
+	assertTrue(table.LoadStorage());
+	assertEqual(table.Counter(), 5);
+	assertTrue(table.Top());
+	for (id=0; id<4; id++) assertTrue(table.Next());
+	assertEqual(table.Select()->pin, 6);
+	assertTrue(table.Select()->blinking);
+	assertEqual(table.Select()->delay_ms, 1000);
+}
+
+test(EncodedMigration)
+{
+	unsigned char id;
+	uint8_t mode;
+	T_LED_V1 led;
+	XTable<T_LED_V1> previous;
+	XTable<T_LED> table;
+
+	assertTrue(previous.InitBuffer(10));
+	previous.SetSchema(1);
+	for (id=0; id<5; id++)
+	{
+		led.pin = id+2;
+		led.blinking = (id & 1);
+		assertTrue(previous.Insert(led));
+	}
+	assertTrue(table.InitBuffer(10));
+
+	for (mode = XTable<T_LED>::PORTABLE_RECORDS; mode <= (XTable<T_LED>::PORTABLE_RECORDS | XTable<T_LED>::PACKED_RECORDS); mode += XTable<T_LED>::PACKED_RECORDS)
+	{
+		blinking_LEDs.eeprom.Fill(88, 200, 0);
+		assertTrue((previous.InitStorage(88, 10, XTable<T_LED_V1>::SCHEMA_VERSION | mode)));
+		assertTrue(previous.SaveStorage());
+
+		/// Fields decoded with the current layout
+		table.SetSchema(2, MigrateLEDFields);
+		table.SetSavePolicy(60000);
+		assertTrue((table.InitStorage(88, 10, XTable<T_LED>::SCHEMA_VERSION | mode)));
+		assertFalse(table.RequestSave(0));
+		assertTrue(table.LoadStorage());
+		assertEqual(table.Counter(), 5);
+		assertTrue(table.Top());
+		for (id=0; id<5; id++)
+		{
+			assertEqual(table.Select()->pin, id+2);
+			assertEqual(table.Select()->blinking, (bool) (id & 1));
+			assertEqual(table.Select()->delay_ms, 1000);
+			table.Next();
+		}
+
+		/// Request dropped by loading
+		assertTrue(table.FlushStorage(1));
+	}
+}
+
+test(PortableRecords)
+{
+	int top;
+
+	SaveSampleStorage(88, 10);
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.PORTABLE_RECORDS));
+	assertEqual(blinking_LEDs.SizeStorage(10, blinking_LEDs.PORTABLE_RECORDS), 10*7 + 2*10 + 4);
+
+	assertTrue(blinking_LEDs.Top());
+	LED = *blinking_LEDs.Select();
+	LED.delay_ms = 0x12345678;
+	assertTrue(blinking_LEDs.Update(LED));
+	assertTrue(blinking_LEDs.SaveStorage());
+
+	/// Packed little endian fields followed by the enabled flag
+	top = blinking_LEDs.GetTopAddressStorage();
+	assertEqual(blinking_LEDs.eeprom.read(top), 10);
+	assertEqual(blinking_LEDs.eeprom.read(top+2), 0x78);
+	assertEqual(blinking_LEDs.eeprom.read(top+5), 0x12);
+	assertEqual(blinking_LEDs.eeprom.read(top+6), 1);
+	assertEqual(blinking_LEDs.eeprom.read(top+7), 9);
+
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 10);
+	assertTrue(blinking_LEDs.Top());
+	assertEqual(blinking_LEDs.Select()->pin, 10);
+	assertEqual(blinking_LEDs.Select()->delay_ms, 0x12345678);
+	assertTrue(blinking_LEDs.Next());
+	assertEqual(blinking_LEDs.Select()->pin, 9);
+}
+
+test(PackedRecords)
+{
+	int top;
+
+	SaveSampleStorage(88, 10);
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.PACKED_RECORDS));
+	assertEqual(blinking_LEDs.SizeStorage(10, blinking_LEDs.PACKED_RECORDS), 10*(int) sizeof(T_LED) + 2*10 + 4);
+	assertTrue(blinking_LEDs.SaveStorage());
+
+	/// Items back to back without enabled flag
+	top = blinking_LEDs.GetTopAddressStorage();
+	assertEqual(blinking_LEDs.eeprom.read(top), 10);
+	assertEqual(blinking_LEDs.eeprom.read(top + sizeof(T_LED)), 9);
+
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 10);
+	assertTrue(blinking_LEDs.Top());
+	assertEqual(blinking_LEDs.Select()->pin, 10);
+
+	/// Packed portable encoding
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, blinking_LEDs.PACKED_RECORDS | blinking_LEDs.PORTABLE_RECORDS));
+	assertEqual(blinking_LEDs.SizeStorage(10, blinking_LEDs.PACKED_RECORDS | blinking_LEDs.PORTABLE_RECORDS), 10*6 + 2*10 + 4);
+	assertTrue(blinking_LEDs.SaveStorage());
+	top = blinking_LEDs.GetTopAddressStorage();
+	assertEqual(blinking_LEDs.eeprom.read(top), 10);
+	assertEqual(blinking_LEDs.eeprom.read(top+6), 9);
+
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 10);
+	assertTrue(blinking_LEDs.Top());
+	assertTrue(blinking_LEDs.Next());
+	assertEqual(blinking_LEDs.Select()->pin, 9);
+}
+
+bool CheckStoredItem(XTable<T_LED>::XItem<T_LED> *stored, void *context)
+{
+	unsigned char *id = (unsigned char *) context;
+	return (stored->item.pin == (*id)--);
+}
+
+test(ForEachStored)
+{
+	unsigned char id;
+	XTable<T_LED>::XItem<T_LED> stored;
+
+	SaveSampleStorage(88, 10);
+
+	blinking_LEDs.Clean();
+
+	/// Walk LED.pin = 10 .. LED.pin = 1 without loading the runtime list
+	id=10;
+	assertTrue(blinking_LEDs.ForEachStored(&stored, CheckStoredItem, &id));
+	assertEqual(id, 0);
+	assertEqual(blinking_LEDs.Counter(), 0);
+
+	blinking_LEDs.eeprom.Fill(88, 100, 0);
+	assertFalse(blinking_LEDs.ForEachStored(&stored, CheckStoredItem, &id));
+}
+
+test(CompressedRecords)
+{
+	unsigned char id;
+	uint8_t mode = blinking_LEDs.COMPRESSED_RECORDS | blinking_LEDs.PACKED_RECORDS | blinking_LEDs.PORTABLE_RECORDS;
+	XTable<T_LED>::XItem<T_LED> stored;
+
+	/// Consecutive pins with the same settings
+	blinking_LEDs.Clean();
+	LED.blinking = true;
+	LED.delay_ms = 500;
+	for (id=MAX_NUM_ITEMS; id>0; id--)
+	{
+		LED.pin = id;
+		assertTrue(blinking_LEDs.Insert(LED));
+	}
+
+	/// More items than locations
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	assertTrue(blinking_LEDs.InitStorage(88, 10, mode));
+	assertTrue(blinking_LEDs.SaveStorage());
+	assertEqual(blinking_LEDs.PreEraseStorage(), (bool) XEEPROM_SPLIT_CYCLES);
+	assertTrue(blinking_LEDs.SaveStorage());
+
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), MAX_NUM_ITEMS);
+	assertTrue(blinking_LEDs.Top());
+	assertEqual(blinking_LEDs.Select()->pin, MAX_NUM_ITEMS);
+	for (id=0; id<MAX_NUM_ITEMS-1; id++) assertTrue(blinking_LEDs.Next());
+	assertEqual(blinking_LEDs.Select()->pin, 1);
+	assertTrue(blinking_LEDs.Select()->blinking);
+	assertEqual(blinking_LEDs.Select()->delay_ms, 500);
+
+	id=MAX_NUM_ITEMS;
+	assertTrue(blinking_LEDs.ForEachStored(&stored, CheckStoredItem, &id));
+	assertEqual(id, 0);
+
+	/// Items without repetitions exceed the parameter buffer
+	assertTrue(blinking_LEDs.Top());
+	do
+	{
+		LED = *blinking_LEDs.Select();
+		LED.delay_ms = LED.pin * LED.pin * 0x01010101UL;
+		assertTrue(blinking_LEDs.Update(LED));
+	}
+	while (blinking_LEDs.Next());
+	assertFalse(blinking_LEDs.SaveStorage());
+}
+
+test(DeltaSnapshots)
+{
+	unsigned char id;
+	int top;
+	XTable<T_LED> table;
+	XTable<T_LED> loaded;
+
+	blinking_LEDs.eeprom.Fill(88, 300, 0);
+	assertTrue(table.InitBuffer(10));
+	assertTrue(loaded.InitBuffer(10));
+	for (id=1; id<4; id++)
+	{
+		LED.pin = id;
+		LED.delay_ms = 100;
+		assertTrue(table.Insert(LED));
+	}
+	assertTrue((table.InitStorage(88, 10, XTable<T_LED>::DELTA_SNAPSHOTS)));
+	assertTrue(table.SaveStorage());
+	top = table.GetTopAddressStorage();
+
+	/// Only the changed item is stored, beyond the base collection
+	assertTrue(table.Top());
+	assertTrue(table.Next());
+	LED = *table.Select();
+	LED.delay_ms = 1234;
+	assertTrue(table.Update(LED));
+	assertTrue(table.SaveStorage());
+	assertEqual(table.GetTopAddressStorage(), top + (int) sizeof(*table.xitem));
+	assertEqual(table.eeprom.Read(top + 3*sizeof(*table.xitem))->item.delay_ms, 1234);
+	assertEqual(table.eeprom.Read(top + sizeof(*table.xitem))->item.delay_ms, 100);
+
+	/// Unchanged items are not stored again
+	assertTrue(table.SaveStorage());
+	assertEqual(table.GetTopAddressStorage(), top + (int) sizeof(*table.xitem));
+
+	assertTrue((loaded.InitStorage(88, 10, XTable<T_LED>::DELTA_SNAPSHOTS)));
+	assertTrue(loaded.LoadStorage());
+	assertEqual(loaded.Counter(), 3);
+	assertTrue(loaded.Top());
+	assertEqual(loaded.Select()->delay_ms, 100);
+	assertTrue(loaded.Next());
+	assertEqual(loaded.Select()->delay_ms, 1234);
+
+	/// Full collection beyond the maximum chain
+	table.SetDeltaChain(1);
+	assertTrue(table.Top());
+	LED = *table.Select();
+	LED.delay_ms = 4321;
+	assertTrue(table.Update(LED));
+	assertTrue(table.SaveStorage());
+	assertEqual(table.GetTopAddressStorage(), top + 2*(int) sizeof(*table.xitem));
+	assertEqual(table.eeprom.Read(table.GetTopAddressStorage())->item.delay_ms, 4321);
+
+	assertTrue(loaded.LoadStorage());
+	assertTrue(loaded.Top());
+	assertEqual(loaded.Select()->delay_ms, 4321);
+	assertTrue(loaded.Next());
+	assertEqual(loaded.Select()->delay_ms, 1234);
+}
+
+test(WarmBoot)
+{
+	blinking_LEDs.eeprom.Fill(88, 300, 0);
+	memset(&resident_LEDs, 0x5A, sizeof(resident_LEDs));
+
+	/// Cold start: empty buffer, storage loaded as usual
+	{
+		XTable<T_LED> table;
+
+		assertFalse(table.InitBuffer(&resident_LEDs));
+		assertEqual(table.Counter(), 0);
+		LED.pin = 4;
+		LED.delay_ms = 250;
+		assertTrue(table.Insert(LED));
+		assertTrue(table.InitStorage(88, 10));
+		assertTrue(table.SaveStorage());
+	}
+
+	/// Soft reset: sealed table adopted together with its storage
+	{
+		XTable<T_LED> table;
+
+		assertTrue(table.InitBuffer(&resident_LEDs));
+		assertEqual(table.Counter(), 1);
+		assertTrue(table.Top());
+		assertEqual(table.Select()->delay_ms, 250);
+		LED.delay_ms = 500;
+		assertTrue(table.Update(LED));
+		assertTrue(table.SaveStorage());
+	}
+
+	{
+		XTable<T_LED> table;
+
+		assertTrue(table.InitBuffer(&resident_LEDs));
+		assertTrue(table.Top());
+		assertEqual(table.Select()->delay_ms, 500);
+
+		/// Unsaved changes discard the seal
+		assertTrue(table.Insert(LED));
+	}
+
+	{
+		XTable<T_LED> table;
+
+		assertFalse(table.InitBuffer(&resident_LEDs));
+		assertEqual(table.Counter(), 0);
+		assertTrue(table.InitStorage(88, 10));
+		assertTrue(table.LoadStorage());
+		assertEqual(table.Counter(), 1);
+	}
+
+	/// Changed bytes of a sealed buffer
+	resident_LEDs.records[0].item.delay_ms ^= 1;
+	{
+		XTable<T_LED> table;
+
+		assertFalse(table.InitBuffer(&resident_LEDs));
+	}
+}
+
+test(DefaultsStorage)
+{
+	XTable<T_LED> table;
+	XTable<T_LED> loaded;
+	XTable<T_LED> small;
+	unsigned char pins[] = { 2, 3, 5, 9 };
+	int id;
+
+	blinking_LEDs.eeprom.Fill(88, 300, 0);
+	assertTrue(table.InitBuffer(6));
+	assertTrue(table.InitDefaults(default_LEDs, 4));
+	assertTrue(table.Top());
+	assertTrue(table.Next());
+	LED = *table.Select();
+	LED.delay_ms = 1234;
+	assertTrue(table.Update(LED));
+	assertTrue(table.Next());
+	assertTrue(table.Delete());
+	LED.pin = 9;
+	assertTrue(table.Insert(LED));
+
+	/// The whole table is stored in order
+	assertTrue(table.InitStorage(88, 6));
+	assertTrue(table.SaveStorage());
+	assertTrue(loaded.InitBuffer(6));
+	assertTrue(loaded.InitStorage(88, 6));
+	assertTrue(loaded.LoadStorage());
+	id = 0;
+	assertTrue(loaded.Top());
+	do assertEqual(loaded.Select()->pin, pins[id++]);
+	while (loaded.Next());
+	assertEqual(id, 4);
+	assertTrue(loaded.Top());
+	assertTrue(loaded.Next());
+	assertEqual(loaded.Select()->delay_ms, 1234);
+
+	/// Default items are stored straight from flash and keep no slot
+	assertTrue(small.InitBuffer(2));
+	assertTrue(small.InitDefaults(default_LEDs, 4));
+	LED.pin = 9;
+	assertTrue(small.Insert(LED));
+	assertTrue(small.InitStorage(88, 6));
+	assertTrue(small.SaveStorage());
+	assertTrue(small.Top());
+	LED = *small.Select();
+	LED.delay_ms = 4321;
+	assertTrue(small.Update(LED));
+	assertFalse(small.Insert(LED));
+	assertTrue(small.SaveStorage());
+	assertTrue(loaded.LoadStorage());
+	assertEqual(loaded.Counter(), 5);
+	assertTrue(loaded.Top());
+	assertEqual(loaded.Select()->delay_ms, 4321);
+	for (id=0; id<4; id++) assertTrue(loaded.Next());
+	assertEqual(loaded.Select()->pin, 9);
+}
+
 test(GetTopAddressStorage)
 {
 	unsigned int id;
@@ -352,7 +1177,138 @@ test(NextFreeAddressStorage)
 	assertEqual( blinking_LEDs.eeprom.Read(newAddress)->item.delay_ms, 90);
 }
 
-#endif
+test(InitPoolStorage)
+{
+	int size;
+
+	blinking_LEDs.eeprom.Fill(88, 200, 0);
+	size = blinking_LEDs.SizeStorage(MAX_NUM_ITEMS);
+
+	/// Area of 30 locations, plus less than one more
+	assertTrue(blinking_LEDs.InitPoolStorage(88, 88 + size + sizeof(*blinking_LEDs.xitem) - 1));
+	assertEqual(blinking_LEDs.NextFreeAddressStorage(), 88 + size);
+
+	/// Area smaller than the buffer on SRAM
+	assertFalse(blinking_LEDs.InitPoolStorage(88, 88 + size - 2));
+	assertFalse(blinking_LEDs.InitPoolStorage(88, XEEPROM_END + 1));
+
+	/// Stored table kept while the same area is specified
+	SaveSampleStorage(88, 10);
+	assertTrue(blinking_LEDs.InitPoolStorage(88, 88 + size - 1));
+	assertTrue(blinking_LEDs.SaveStorage());
+	assertTrue(blinking_LEDs.InitPoolStorage(88, 88 + size - 1));
+	blinking_LEDs.Clean();
+	assertTrue(blinking_LEDs.LoadStorage());
+	assertEqual(blinking_LEDs.Counter(), 10);
+}
+
+test(Directory)
+{
+	XDirectory tables;
+	int size;
+	int address;
+
+	blinking_LEDs.eeprom.Fill(0, 100, 0);
+
+	assertFalse(tables.InitDirectory(0, 0));
+	assertTrue(tables.InitDirectory(0, 2));
+	assertEqual(tables.GetAddress(0), -1);
+
+	/// Directory block: marker + max number of tables + number of tables + 2 entries
+	size = blinking_LEDs.SizeStorage(10);
+	address = tables.Allocate(0, size);
+	assertEqual(address, 3 + 2*4);
+	assertEqual(tables.Allocate(1, size), address + size);
+	assertEqual(tables.NextFreeAddress(), address + 2*size);
+	assertEqual(tables.Allocate(2, size), -1);
+
+	/// Regions already assigned are kept as they are
+	assertTrue(tables.InitDirectory(0, 2));
+	assertEqual(tables.Allocate(0, size), address);
+	assertEqual(tables.Allocate(0, size+1), -1);
+	assertEqual(tables.GetAddress(1), address + size);
+
+	assertTrue(blinking_LEDs.InitStorage(tables.GetAddress(1), 10));
+	assertEqual(blinking_LEDs.NextFreeAddressStorage(), tables.NextFreeAddress());
+}
+
+typedef XLayout<100, XRegion<T_LED, 10>, XRegion<T_LED, 4, XTable<T_LED>::BITCLEAR_STATUS> > TestLayout;
+
+test(Layout)
+{
+	XTable<T_LED> leds;
+	XTable<T_LED> others;
+	int count = TestLayout::Count;
+
+	blinking_LEDs.eeprom.Fill(100, TestLayout::Begin(2) - 100, 0);
+
+	/// Regions placed one after the other, each one as large as SizeStorage
+	assertEqual(count, 2);
+	assertEqual(TestLayout::Begin(0), 100);
+	assertEqual(TestLayout::Begin(1), 100 + leds.SizeStorage(10));
+	assertEqual(TestLayout::Begin(2), TestLayout::Begin(1) + leds.SizeStorage(4, XTable<T_LED>::BITCLEAR_STATUS));
+
+	assertTrue((leds.InitStorage<TestLayout, 0>()));
+	assertEqual(leds.NextFreeAddressStorage(), TestLayout::Begin(1));
+	assertEqual(leds.GetTopAddressStorage(), TestLayout::ParameterBegin(0));
+
+	assertTrue((others.InitStorage<TestLayout, 1>()));
+	assertEqual(others.NextFreeAddressStorage(), TestLayout::Begin(2));
+	/// Bit-clear status formatted to 0x00: top at the last location
+	assertEqual(others.GetTopAddressStorage(), TestLayout::ParameterBegin(1) + 3*sizeof(*others.xitem));
+}
+
+test(Profiles)
+{
+	unsigned char id;
+	XTable<T_LED> table;
+
+	assertFalse(table.InitProfiles(2));
+	assertTrue(table.InitBuffer(10));
+	assertTrue(table.InitProfiles(2));
+	assertFalse(table.SelectProfile(2));
+
+	/// Profile 0 with 1 entry, profile 1 with 2 entries
+	LED.pin = 1;
+	assertTrue(table.Insert(LED));
+
+	assertTrue(table.SelectProfile(1));
+	assertEqual(table.Counter(), 0);
+	LED.pin = 2;
+	assertTrue(table.Insert(LED));
+	assertTrue(table.Insert(LED));
+
+	assertTrue(table.SelectProfile(0));
+	assertEqual(table.CurrentProfile(), 0);
+	assertEqual(table.Counter(), 1);
+	assertTrue(table.Top());
+	assertEqual(table.Select()->pin, 1);
+
+	/// Default items kept by their own profile
+	assertTrue(table.SelectProfile(1));
+	assertTrue(table.InitDefaults(default_LEDs, 4));
+	assertTrue(table.SelectProfile(0));
+	assertEqual(table.Counter(), 1);
+	assertTrue(table.SelectProfile(1));
+	assertEqual(table.Counter(), 4);
+	assertTrue(table.Top());
+	assertEqual(table.Select()->pin, 2);
+
+	/// Wear leveled slot of 4 bytes keeping the selected profile
+	table.eeprom.Fill(88, 4, 0xFF);
+	assertEqual(table.LoadProfile(88, 4), -1);
+
+	for (id=0; id<5; id++)
+	{
+		assertTrue(table.SelectProfile(id%2));
+		assertTrue(table.SaveProfile(88, 4));
+		assertEqual(table.LoadProfile(88, 4), id%2);
+	}
+
+	/// Slot erased once after 4 selections
+	assertEqual(table.eeprom.read(88), 0);
+	assertEqual(table.eeprom.read(89), 0xFF);
+}
 
 
 
@@ -393,11 +1349,32 @@ int main(int argc, char *argv[]) {
 	Test::include("Counter");
 	Test::include("Top");
 	Test::include("Next");
+	Test::include("Defaults");
+	Test::include("Handles");
+	Test::include("Positions");
 	Test::include("InitStorage");
 	Test::include("SaveStorage");
 	Test::include("LoadStorage");
+	Test::include("SavePolicy");
+	Test::include("ForEachStored");
+	Test::include("CompressedRecords");
+	Test::include("DeltaSnapshots");
+	Test::include("WarmBoot");
+	Test::include("DefaultsStorage");
+	Test::include("PreEraseStorage");
+	Test::include("BitClearStatus");
+	Test::include("WearReport");
+	Test::include("SnapshotHash");
+	Test::include("SchemaMigration");
+	Test::include("EncodedMigration");
+	Test::include("PortableRecords");
+	Test::include("PackedRecords");
 	Test::include("GetTopAddressStorage");
 	Test::include("NextFreeAddressStorage");
+	Test::include("InitPoolStorage");
+	Test::include("Directory");
+	Test::include("Layout");
+	Test::include("Profiles");
 
 	while(1) Test::run();
 
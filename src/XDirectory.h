@@ -0,0 +1,224 @@
+/****************************************************************************
+ * XDirectory.h - Class for Arduino sketches                                *
+ * Copyright (C) 2015 by AF                                                 *
+ *                                                                          *
+ * This file is part of AF Support                                          *
+ *                                                                          *
+ *   XDirectory is free software: you can redistribute it and/or modify it  *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   XDirectory is distributed in the hope that it will be useful,          *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with XDirectory. If not, see                             *
+ *   <http://www.gnu.org/licenses/>.                                        *
+ ****************************************************************************/
+
+/**
+ *  @file    XDirectory.h
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *	@brief EEPROM partition manager for several XTable storages
+ *
+ *  @section DESCRIPTION
+ *
+ *  This class assigns EEPROM regions to any number of XTable instances and keeps
+ *  them into a short directory block. Regions are assigned once, when the directory
+ *  is formatted, then each table finds its own region through a direct access to
+ *  the related directory entry. Switching between tables does not write any byte.
+ *
+ */
+
+
+#include "XEEPROM/XEEPROM.h"
+
+#ifndef XDirectory_H_
+#define XDirectory_H_
+
+
+class XDirectory
+{
+  public:
+
+    const unsigned char DMK = 0x44;
+
+    /// Default constructor
+    XDirectory();
+
+    /**
+     * @brief Method to format specified EEPROM area as directory of table regions.
+     *
+     * This method checks the directory at specified address. If the directory is unformatted
+     * or it is formatted for a different number of tables, all entries are removed.\n
+     *
+     * Directory structure:
+     * <table border="0">
+     * <tr><th>Marker</th><td>Max Tables</td><td>Tables</td><td>Entry 0</td><td>...</td><td>Entry <max>-1</td></tr>
+     * <tr><th>(0x44)</th><td>(<max>)</td><td>(<n>)</td><td>(<addr>) (<size>)</td><td>...</td><td>(<addr>) (<size>)</td></tr>
+     * </table>
+     *
+     * Where each entry keeps start address and size (2 bytes, MSB first) of a table region.
+     *
+     * @param start_location describe the start EEPROM address of the directory
+     * @param max_tables describe maximum number of table regions
+     * @retval true directory ready to assign table regions
+     * @retval false unsuccess. Directory cannot be prepared because of size or unavailable EEPROM
+     */
+    bool InitDirectory(int start_location, int max_tables);
+
+    /**
+     * @brief Method to assign an EEPROM region to specified table.
+     *
+     * Tables are identified by consecutive numbers starting from 0. A new region is
+     * appended beyond the last assigned one. Already assigned regions are returned
+     * as they are, without any write on EEPROM.
+     *
+     * @param table_id identifier of the table (0 .. max_tables-1)
+     * @param size size of the required region (see XTable::SizeStorage)
+     * @retval address start EEPROM address of the region
+     * @retval -1 unsuccess. Region cannot be assigned (wrong identifier, different size or full EEPROM)
+     */
+    int Allocate(int table_id, unsigned int size);
+
+    /**
+     * @brief Method to get the start address of the region assigned to specified table
+     *
+     * @param table_id identifier of the table
+     * @retval address start EEPROM address of the region
+     * @retval -1 unsuccess. No region assigned to specified table
+     */
+    int GetAddress(int table_id);
+
+    /**
+      * @brief Method to get the next available address beyond all assigned regions
+      *
+      * @param None
+      * @retval address of the next available location
+      */
+    int NextFreeAddress();
+
+    /// Shared instance of the Arduino EEPROM
+    XEEPROM<uint8_t> eeprom;
+
+
+  private:
+
+    int directory_begin;
+    int directory_max_tables;
+
+    int GetEntryLocation(int table_id);
+
+    int ReadWord(int location);
+
+    void WriteWord(int location, unsigned int value);
+};
+
+
+/******************************************************************************
+ * User API
+ ******************************************************************************/
+
+inline XDirectory::XDirectory()
+{
+    // Flag for InitDirectory process
+    directory_max_tables = -1;
+}
+
+inline bool XDirectory::InitDirectory(int start_location, int max_tables)
+{
+    directory_max_tables = -1;
+
+    /// Validate directory limits
+    if ((max_tables<=0) || (max_tables > 255) || (start_location<0)) return false;
+
+    directory_begin = start_location;
+    directory_max_tables = max_tables;
+
+    if ((GetEntryLocation(max_tables)-1) > XEEPROM_END) return false;
+
+    if ( !((eeprom.read(directory_begin)==DMK) &&
+         (eeprom.read(directory_begin+1)==directory_max_tables) &&
+         (eeprom.read(directory_begin+2)<=directory_max_tables)) )
+    {
+        eeprom.write(directory_begin, DMK);
+        eeprom.write(directory_begin+1, directory_max_tables);
+        eeprom.write(directory_begin+2, 0);
+        eeprom.Flush();
+    }
+
+    return true;
+}
+
+inline int XDirectory::Allocate(int table_id, unsigned int size)
+{
+    int tables;
+    int address;
+
+    if ((directory_max_tables<=0) || (table_id<0) || (table_id>=directory_max_tables)) return -1;
+
+    tables = eeprom.read(directory_begin+2);
+
+    /// Region already assigned
+    if (table_id < tables)
+    {
+        if ((unsigned int) ReadWord(GetEntryLocation(table_id)+2) != size) return -1;
+        return GetAddress(table_id);
+    }
+
+    /// Regions are assigned in order of identifier
+    if (table_id > tables) return -1;
+
+    address = NextFreeAddress();
+    if ((address+size-1) > XEEPROM_END) return -1;
+
+    WriteWord(GetEntryLocation(table_id), address);
+    WriteWord(GetEntryLocation(table_id)+2, size);
+    eeprom.write(directory_begin+2, tables+1);
+    eeprom.Flush();
+
+    return address;
+}
+
+inline int XDirectory::GetAddress(int table_id)
+{
+    if ((directory_max_tables<=0) || (table_id<0) || (table_id>=eeprom.read(directory_begin+2))) return -1;
+
+    return ReadWord(GetEntryLocation(table_id));
+}
+
+inline int XDirectory::NextFreeAddress()
+{
+    int tables;
+
+    if (directory_max_tables<=0) return -1;
+
+    tables = eeprom.read(directory_begin+2);
+    if (!tables) return GetEntryLocation(directory_max_tables);
+
+    return ReadWord(GetEntryLocation(tables-1)) + ReadWord(GetEntryLocation(tables-1)+2);
+}
+
+inline int XDirectory::GetEntryLocation(int table_id)
+{
+    return directory_begin + 3 + 4*table_id;
+}
+
+inline int XDirectory::ReadWord(int location)
+{
+    return (eeprom.read(location) << 8) + eeprom.read(location+1);
+}
+
+inline void XDirectory::WriteWord(int location, unsigned int value)
+{
+    eeprom.write(location, value >> 8);
+    eeprom.write(location+1, value & 0x00FF);
+}
+
+#endif /* XDirectory_H_ */
@@ -0,0 +1,437 @@
+/****************************************************************************
+ * XFlash.h - Class for Arduino sketches                                    *
+ * Copyright (C) 2015 by AF                                                 *
+ *                                                                          *
+ * This file is part of AF Support                                          *
+ *                                                                          *
+ *   XFlash is free software: you can redistribute it and/or modify it      *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   XFlash is distributed in the hope that it will be useful,              *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with XFlash. If not, see <http://www.gnu.org/licenses/>. *
+ ****************************************************************************/
+
+/**
+ *  @file    XFlash.h
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *	@brief Log-structured XTable storage for NOR flash
+ *
+ *  @section DESCRIPTION
+ *
+ *  This class stores the items of an XTable on NOR flash, where bits move from
+ *  1 to 0 only and are set back through the erase of a whole sector. Each stored
+ *  collection of items (snapshot) is appended beyond the previous one within the
+ *  erased space of the current sector, so that each byte is programmed once between erases:
+ *  the commit byte of a snapshot is left erased until all of its items are programmed.
+ *  A full sector moves the log to the following one (circular): the snapshots of
+ *  the oldest sector are obsolete and the whole sector is erased at once.\n
+ *
+ *  Items are stored with the portable encoding of XRecord<X> (see XRecord.h).
+ *  The device is provided through the hooks:
+ *   - XFLASH_SECTOR_SIZE: bytes of each erase sector (4096 by default)
+ *   - XFLASH_READ(address, data, size): read consecutive bytes
+ *   - XFLASH_PROGRAM(address, data, size): program consecutive bytes of an erased area
+ *   - XFLASH_ERASE(address): erase the sector starting from the address
+ *
+ *  @code
+ *  XFlashTable<T_LED> leds;
+ *
+ *  leds.InitBuffer(18);
+ *  leds.InitStorage(0x10000, 2);
+ *  leds.LoadStorage();
+ *  @endcode
+ */
+
+
+#include "XTable.h"
+
+#ifndef XFlash_H_
+#define XFlash_H_
+
+#ifndef XFLASH_SECTOR_SIZE
+#define XFLASH_SECTOR_SIZE 4096
+#endif
+
+#if !defined(XFLASH_READ) || !defined(XFLASH_PROGRAM) || !defined(XFLASH_ERASE)
+#error "XFlash: XFLASH_READ, XFLASH_PROGRAM and XFLASH_ERASE hooks expected"
+#endif
+
+
+/// The runtime list is an XTable kept private, so that none of its EEPROM storage methods
+/// (i.e. RequestSave, FlushStorage, WearReport, MigrateStorage) can be reached through a flash
+/// table: each collection is appended to the log through SaveStorage only
+template <class X> class XFlashTable : private XTable<X>
+{
+  public:
+
+    const unsigned char FMK = 0x46;
+    const unsigned char SMK = 0x53;
+
+    typedef typename XTable<X>::Handle Handle;
+
+    template <int MAX_ITEMS> using Resident = typename XTable<X>::template Resident<MAX_ITEMS>;
+
+    /// Runtime list on SRAM (see XTable). A resident buffer keeps the runtime list only:
+    /// InitStorage is still expected after a soft reset, LoadStorage is not.
+    using XTable<X>::InitBuffer;
+    using XTable<X>::InitDefaults;
+    using XTable<X>::Insert;
+    using XTable<X>::Select;
+    using XTable<X>::Update;
+    using XTable<X>::Delete;
+    using XTable<X>::Clean;
+    using XTable<X>::Counter;
+    using XTable<X>::Top;
+    using XTable<X>::Next;
+    using XTable<X>::At;
+    using XTable<X>::Seek;
+    using XTable<X>::Seal;
+
+    /// Default constructor
+    XFlashTable();
+
+    /**
+     * @brief Method to prepare specified flash sectors as log of stored collections
+     *
+     * This method looks for the sector written last, through the sequence number
+     * of each sector header, and for the last snapshot completely stored. If no sector
+     * is formatted for the items of the table, the first one is erased and formatted.\n
+     *
+     * Sector structure:
+     * <table border="0">
+     * <tr><th>Marker</th><td>Item Size</td><td>Reserved</td><td>Sequence</td><td>Snapshot</td><td>...</td></tr>
+     * <tr><th>(0x46)</th><td>(2 bytes)</td><td>(0xFF)</td><td>(4 bytes)</td><td>(0x53) (count) (commit) (items)</td><td>...</td></tr>
+     * </table>
+     *
+     * Where commit is 0xFF until all the items of the snapshot are programmed, then 0x00.
+     *
+     * @param start_location describe the start flash address of the first sector
+     * @param sectors describe the number of sectors of the log (2 at least)
+     * @retval true storage ready to store collections of items
+     * @retval false unsuccess. Wrong number of sectors
+     */
+    bool InitStorage(unsigned long start_location, int sectors);
+
+    /**
+     * @brief Method to append current collection of items to the log
+     *
+     * An unchanged collection is not stored again. Only the erase of the following
+     * sector, when the current one is full, may take longer.
+     *
+     * @param None
+     * @retval true items stored as expected
+     * @retval false unsuccess. Storage not initialized or items larger than a sector
+     */
+    bool SaveStorage();
+
+    /**
+     * @brief Method to copy the last stored collection of items to the runtime list on SRAM
+     *
+     * @param None
+     * @retval true table copied from the flash to the runtime list on SRAM as expected
+     * @retval false unsuccess. No collection stored or larger than the runtime list
+     */
+    bool LoadStorage();
+
+    /**
+      * @brief Method to get the size of the storage
+      *
+      * @param sectors number of sectors of the log
+      * @retval size of the storage
+      */
+    unsigned long SizeStorage(int sectors);
+
+
+  private:
+
+    enum
+    {
+        SECTOR_HEADER = 8,      ///< Marker, item size, reserved byte and sequence
+        SNAPSHOT_HEADER = 3,    ///< Marker, count and commit
+        SNAPSHOT_COMMIT = 2     ///< Offset of the commit byte
+    };
+
+    unsigned long flash_begin;
+    int flash_sectors;
+    int flash_sector;                   ///< Sector of the log tail
+    unsigned long flash_sequence;       ///< Sequence of the sector of the log tail
+    unsigned int flash_offset;          ///< First erased byte of the sector of the log tail
+    unsigned long flash_snapshot;       ///< Last snapshot completely stored
+    bool flash_stored;
+
+    unsigned long GetSectorLocation(int sector);
+
+    bool CheckSector(int sector, unsigned long *sequence);
+
+    unsigned int ScanSector(int sector);
+
+    void FormatSector(int sector, unsigned long sequence);
+
+    bool IsStored();
+};
+
+
+/******************************************************************************
+ * User API
+ ******************************************************************************/
+
+template <class X> XFlashTable<X>::XFlashTable()
+{
+    // Flag for InitStorage process
+    flash_sectors = -1;
+    flash_stored = false;
+}
+
+template <class X> bool XFlashTable<X>::InitStorage(unsigned long start_location, int sectors)
+{
+    unsigned long sequence;
+    int sector;
+    int previous;
+
+    flash_sectors = -1;
+    flash_stored = false;
+
+    if (sectors < 2) return false;
+
+    flash_begin = start_location;
+    flash_sectors = sectors;
+
+    /// Sector written last (sequence numbers wrap around)
+    flash_sector = -1;
+    for (sector = 0; sector < flash_sectors; sector++)
+    {
+        if (!CheckSector(sector, &sequence)) continue;
+        if ((flash_sector < 0) || ((int32_t) (sequence - flash_sequence) > 0))
+        {
+            flash_sector = sector;
+            flash_sequence = sequence;
+        }
+    }
+
+    if (flash_sector < 0)
+    {
+        FormatSector(0, 1);
+        return true;
+    }
+
+    flash_offset = ScanSector(flash_sector);
+
+    /// A sector interrupted before its first snapshot keeps the last one on the previous sector
+    if (!flash_stored)
+    {
+        previous = (flash_sector ? flash_sector : flash_sectors) - 1;
+        if ((CheckSector(previous, &sequence)) && (sequence == flash_sequence - 1)) ScanSector(previous);
+    }
+
+    return true;
+}
+
+template <class X> bool XFlashTable<X>::SaveStorage()
+{
+    unsigned long location;
+    unsigned int length;
+    uint8_t header[SNAPSHOT_HEADER];
+    uint8_t media[XRecord<X>::Size];
+    uint8_t commit;
+    int position;
+    typename XTable<X>::template XItem<X> *record;
+    typename XTable<X>::template XItem<X> buffer;
+
+    if ((!this->first_record) || (flash_sectors <= 0) || (this->counter > 255)) return false;
+
+    length = SNAPSHOT_HEADER + this->counter*XRecord<X>::Size;
+    if (length > XFLASH_SECTOR_SIZE - SECTOR_HEADER) return false;
+
+    /// Unchanged table already stored
+    if ((flash_stored) && (IsStored()))
+    {
+        this->save_pending = false;
+        this->Seal();
+        return true;
+    }
+
+    /// The log moves to the following sector, erasing its obsolete snapshots. A sector
+    /// without any complete snapshot is formatted again, keeping the previous one.
+    if (flash_offset + length > XFLASH_SECTOR_SIZE)
+    {
+        if ((flash_stored) && (flash_snapshot >= GetSectorLocation(flash_sector)) &&
+            (flash_snapshot < GetSectorLocation(flash_sector) + XFLASH_SECTOR_SIZE))
+            FormatSector((flash_sector + 1) % flash_sectors, flash_sequence + 1);
+        else FormatSector(flash_sector, flash_sequence);
+    }
+
+    location = GetSectorLocation(flash_sector) + flash_offset;
+
+    /// Commit byte left erased
+    header[0] = SMK;
+    header[1] = this->counter;
+    XFLASH_PROGRAM(location, header, SNAPSHOT_COMMIT);
+
+    /// Default items not updated are read from flash (see InitDefaults)
+    location += SNAPSHOT_HEADER;
+    for (position = 0; (record = this->GetStoredRecord(&position, &buffer)); )
+    {
+        XRecordEncode(&record->item, media);
+        XFLASH_PROGRAM(location, media, XRecord<X>::Size);
+        location += XRecord<X>::Size;
+    }
+
+    /// The snapshot is valid only once all of its items are programmed
+    commit = 0x00;
+    location = GetSectorLocation(flash_sector) + flash_offset;
+    XFLASH_PROGRAM(location + SNAPSHOT_COMMIT, &commit, 1);
+
+    flash_snapshot = location;
+    flash_stored = true;
+    flash_offset += length;
+
+    /// Raw check of data within flash
+    XFLASH_READ(location + SNAPSHOT_COMMIT, &commit, 1);
+    if (commit) return false;
+
+    this->save_pending = false;
+    this->Seal();
+
+    return true;
+}
+
+template <class X> bool XFlashTable<X>::LoadStorage()
+{
+    uint8_t header[SNAPSHOT_HEADER];
+    uint8_t media[XRecord<X>::Size];
+    unsigned long location;
+
+    if ((!this->first_record) || (flash_sectors <= 0) || (!flash_stored)) return false;
+
+    XFLASH_READ(flash_snapshot, header, SNAPSHOT_HEADER);
+    if (header[1] > this->buffer_max_items) return false;
+
+    this->Clean();
+
+    location = flash_snapshot + SNAPSHOT_HEADER;
+    for (this->current_record = this->first_record; this->current_record < this->first_record + header[1]; this->current_record++)
+    {
+        XFLASH_READ(location, media, XRecord<X>::Size);
+        XRecordDecode(media, &this->current_record->item);
+        this->current_record->enabled = true;
+        location += XRecord<X>::Size;
+    }
+
+    this->current_record = NULL;
+    this->counter = header[1];
+
+    /// Runtime list back to the stored one
+    this->save_pending = false;
+    this->Seal();
+
+    return true;
+}
+
+template <class X> unsigned long XFlashTable<X>::SizeStorage(int sectors)
+{
+    return (unsigned long) sectors * XFLASH_SECTOR_SIZE;
+}
+
+
+/******************************************************************************
+ * Private methods
+ ******************************************************************************/
+
+template <class X> unsigned long XFlashTable<X>::GetSectorLocation(int sector)
+{
+    return flash_begin + (unsigned long) sector * XFLASH_SECTOR_SIZE;
+}
+
+template <class X> bool XFlashTable<X>::CheckSector(int sector, unsigned long *sequence)
+{
+    uint8_t header[SECTOR_HEADER];
+
+    XFLASH_READ(GetSectorLocation(sector), header, SECTOR_HEADER);
+
+    *sequence = header[4] + ((unsigned long) header[5] << 8) + ((unsigned long) header[6] << 16) + ((unsigned long) header[7] << 24);
+
+    return ( (header[0] == FMK) &&
+             (header[1] == (XRecord<X>::Size & 0xFF)) &&
+             (header[2] == (XRecord<X>::Size >> 8)) );
+}
+
+/// Snapshots are walked up to the erased space. An interrupted snapshot marks the sector as full,
+/// since the length of the following ones is unknown.
+template <class X> unsigned int XFlashTable<X>::ScanSector(int sector)
+{
+    uint8_t header[SNAPSHOT_HEADER];
+    unsigned int offset;
+    unsigned int length;
+
+    for (offset = SECTOR_HEADER; offset + SNAPSHOT_HEADER <= XFLASH_SECTOR_SIZE; offset += length)
+    {
+        XFLASH_READ(GetSectorLocation(sector) + offset, header, SNAPSHOT_HEADER);
+
+        if ((header[0] == 0xFF) && (header[1] == 0xFF) && (header[2] == 0xFF)) return offset;
+        if ((header[0] != SMK) || (header[2] != 0x00)) break;
+
+        length = SNAPSHOT_HEADER + header[1]*XRecord<X>::Size;
+        if (offset + length > XFLASH_SECTOR_SIZE) break;
+
+        flash_snapshot = GetSectorLocation(sector) + offset;
+        flash_stored = true;
+    }
+
+    return XFLASH_SECTOR_SIZE;
+}
+
+template <class X> void XFlashTable<X>::FormatSector(int sector, unsigned long sequence)
+{
+    uint8_t header[SECTOR_HEADER];
+
+    XFLASH_ERASE(GetSectorLocation(sector));
+
+    header[0] = FMK;
+    header[1] = XRecord<X>::Size & 0xFF;
+    header[2] = XRecord<X>::Size >> 8;
+    header[3] = 0xFF;
+    for (int i=0; i<4; i++) header[4+i] = (sequence >> (8*i)) & 0xFF;
+
+    XFLASH_PROGRAM(GetSectorLocation(sector), header, SECTOR_HEADER);
+
+    flash_sector = sector;
+    flash_sequence = sequence;
+    flash_offset = SECTOR_HEADER;
+}
+
+template <class X> bool XFlashTable<X>::IsStored()
+{
+    uint8_t header[SNAPSHOT_HEADER];
+    uint8_t media[XRecord<X>::Size];
+    uint8_t stored[XRecord<X>::Size];
+    unsigned long location;
+    int position;
+    typename XTable<X>::template XItem<X> *record;
+    typename XTable<X>::template XItem<X> buffer;
+
+    XFLASH_READ(flash_snapshot, header, SNAPSHOT_HEADER);
+    if (header[1] != this->counter) return false;
+
+    location = flash_snapshot + SNAPSHOT_HEADER;
+    for (position = 0; (record = this->GetStoredRecord(&position, &buffer)); )
+    {
+        XRecordEncode(&record->item, media);
+        XFLASH_READ(location, stored, XRecord<X>::Size);
+        if (memcmp(media, stored, XRecord<X>::Size)) return false;
+        location += XRecord<X>::Size;
+    }
+
+    return true;
+}
+
+#endif /* XFlash_H_ */
@@ -0,0 +1,122 @@
+/****************************************************************************
+ * XLayout.h - Class for Arduino sketches                                   *
+ * Copyright (C) 2015 by AF                                                 *
+ *                                                                          *
+ * This file is part of AF Support                                          *
+ *                                                                          *
+ *   XLayout is free software: you can redistribute it and/or modify it     *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   XLayout is distributed in the hope that it will be useful,             *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with XLayout. If not, see <http://www.gnu.org/licenses/>.*
+ ****************************************************************************/
+
+/**
+ *  @file    XLayout.h
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *	@brief Compile-time EEPROM layout planner for several XTable storages
+ *
+ *  @section DESCRIPTION
+ *
+ *  These templates describe the EEPROM regions of several XTable instances and
+ *  compute start, header and data addresses of each region at compile time.
+ *  Regions are placed one after the other from the start address, so they never
+ *  overlap, and the whole layout is checked against the EEPROM size (XEEPROM_END).
+ *
+ *  Requires a C++11 compiler (Arduino IDE 1.6.6 or later).
+ *
+ *  @code
+ *  typedef XLayout<0, XRegion<T_LED, 18>, XRegion<T_CFG, 4, XTable<T_CFG>::BITCLEAR_STATUS> > Layout;
+ *
+ *  leds.InitStorage<Layout, 0>();
+ *  cfg.InitStorage<Layout, 1>();
+ *  @endcode
+ */
+
+
+#include "XTable.h"
+
+#ifndef XLayout_H_
+#define XLayout_H_
+
+
+/**
+ * @brief Description of the EEPROM region of a table
+ *
+ * @param X item type of the table
+ * @param MAX_ITEMS maximum number of entries for the table (1 .. 255)
+ * @param MODE combination of XTable StorageMode flags
+ */
+template <class X, int MAX_ITEMS, uint8_t MODE = 0>
+struct XRegion
+{
+    static_assert((MAX_ITEMS > 0) && (MAX_ITEMS <= 255), "XRegion: 1 .. 255 items expected");
+
+    typedef X Type;
+
+    static constexpr int MaxItems = MAX_ITEMS;
+    static constexpr uint8_t Mode = MODE;
+
+    /// Size of each stored item (see XTable::RecordSize)
+    static constexpr int ItemSize = XTable<X>::RecordSize(MODE);
+
+    /// Markers, status buffer and extended header (see XTable::HeaderSize)
+    static constexpr int HeaderSize = XTable<X>::HeaderSize(MAX_ITEMS, MODE);
+
+    /// Same as XTable::SizeStorage
+    static constexpr int Size = XTable<X>::SizeStorage(MAX_ITEMS, MODE);
+};
+
+
+/**
+ * @brief Sequence of table regions starting from specified EEPROM address
+ *
+ * Begin(i) and ParameterBegin(i) return the start address and the first data address
+ * of the i-th region. Begin(Count) is the next available address beyond all regions.
+ *
+ * @param START start EEPROM address of the first region
+ * @param R list of XRegion descriptions
+ */
+template <int START, class... R>
+struct XLayout;
+
+template <int START>
+struct XLayout<START>
+{
+    static constexpr int Count = 0;
+    static constexpr int End = START;
+
+    static constexpr int Begin(int) { return START; }
+    static constexpr int ParameterBegin(int) { return START; }
+};
+
+template <int START, class R, class... Rs>
+struct XLayout<START, R, Rs...>
+{
+    typedef XLayout<START + R::Size, Rs...> Next;
+
+    static constexpr int Count = 1 + Next::Count;
+    static constexpr int End = Next::End;
+
+    static_assert(START >= 0, "XLayout: negative start address");
+    static_assert(End - 1 <= XEEPROM_END, "XLayout: regions exceed the EEPROM size");
+
+    static constexpr int Begin(int index) { return (index ? Next::Begin(index-1) : START); }
+    static constexpr int ParameterBegin(int index) { return (index ? Next::ParameterBegin(index-1) : START + R::HeaderSize); }
+
+    /// Description of the i-th region
+    template <int I, int DUMMY = 0> struct Region { typedef typename Next::template Region<I-1>::Type Type; };
+    template <int DUMMY> struct Region<0, DUMMY> { typedef R Type; };
+};
+
+#endif /* XLayout_H_ */
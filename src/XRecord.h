@@ -0,0 +1,246 @@
+/****************************************************************************
+ * XRecord.h - Class for Arduino sketches                                   *
+ * Copyright (C) 2015 by AF                                                 *
+ *                                                                          *
+ * This file is part of AF Support                                          *
+ *                                                                          *
+ *   XRecord is free software: you can redistribute it and/or modify it     *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   XRecord is distributed in the hope that it will be useful,             *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with XRecord. If not, see <http://www.gnu.org/licenses/>.*
+ ****************************************************************************/
+
+/**
+ *  @file    XRecord.h
+ *  @author  AF
+ *  @date    08/2015
+ *  @version 1.0
+ *
+ *	@brief Portable encoding of the items stored by XTable
+ *
+ *  @section DESCRIPTION
+ *
+ *  These templates describe the fields of an item type at compile time and
+ *  encode each item as the sequence of its fields, packed and little endian,
+ *  with a fixed width for each of them. The same stored items are then read
+ *  back by any target, whatever padding and size of types of its compiler
+ *  (i.e. AVR and a 64 bit host).\n
+ *
+ *  Fields are listed in declaration order as F(<member>, <width>). A negative
+ *  width marks a signed field, sign extended when the width on SRAM differs.
+ *  Fields are scalar (integer, bool, enum or float). A descriptor reordering the
+ *  members, or leaving bytes of the item other than padding out, fails to compile
+ *  as it would silently change the stored layout.\n
+ *
+ *  Where the encoding already matches the item on SRAM (i.e. AVR: no padding,
+ *  little endian and same widths), it collapses to a plain memcpy at compile time.
+ *  Items without descriptor are always copied as they are.
+ *
+ *  @code
+ *  #define T_LED_FIELDS(F) F(pin, 1) F(blinking, 1) F(delay_ms, 4)
+ *  XRECORD(T_LED, T_LED_FIELDS)
+ *
+ *  leds.InitStorage(0, 18, XTable<T_LED>::PORTABLE_RECORDS);
+ *  @endcode
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef XRecord_H_
+#define XRecord_H_
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+/// Byte order of the target (stored items are always little endian)
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define XRECORD_BIG_ENDIAN 1
+#else
+#define XRECORD_BIG_ENDIAN 0
+#endif
+
+
+/// Description of a field: position and size on SRAM, width on media (negative for signed)
+struct XField
+{
+    unsigned int offset;
+    uint8_t size;
+    int8_t width;
+};
+
+/**
+ * @brief Description of the fields of an item type (see XRECORD)
+ *
+ * Without descriptor the item is stored as it is on SRAM.
+ *
+ * @param X item type
+ */
+template <class X>
+struct XRecord
+{
+    enum
+    {
+        Size = sizeof(X),   ///< Size of the encoded item
+        Raw = 1             ///< Encoding identical to the item on SRAM
+    };
+
+    /// List of fields, terminated by a field of size 0 (NULL without descriptor)
+    static const XField *Fields() { return NULL; }
+};
+
+
+#define XRECORD_WIDTH(width) ((width) < 0 ? -(width) : (width))
+
+#define XRECORD_SIZE(member, width) + XRECORD_WIDTH(width)
+#define XRECORD_RAW(member, width) && (sizeof(((Type *) 0)->member) == XRECORD_WIDTH(width))
+#define XRECORD_FIELD(member, width) { offsetof(Type, member), sizeof(((Type *) 0)->member), width },
+#define XRECORD_ORDER(member, width) , offsetof(Type, member), sizeof(((Type *) 0)->member), alignof(decltype(((Type *) 0)->member))
+
+/// Last field reached: only the trailing padding of the item may follow
+constexpr bool XRecordOrdered(unsigned int end, unsigned int size, unsigned int align)
+{
+    return (end <= size) && (size - end < align);
+}
+
+/// Each field starts where the previous one ends, but for the padding its alignment may require
+/// (none for packed items)
+template <class... F> constexpr bool XRecordOrdered(unsigned int end, unsigned int size, unsigned int align,
+                                                    unsigned int offset, unsigned int field_size, unsigned int field_align, F... fields)
+{
+    return (offset >= end) && (offset - end < field_align) && XRecordOrdered(offset + field_size, size, align, fields...);
+}
+
+/**
+ * @brief Declare the fields of an item type
+ *
+ * @param type item type
+ * @param fields list macro of the fields, expanding F(<member>, <width>) for each of them
+ */
+#define XRECORD(type, fields)                                                                   \
+template <>                                                                                     \
+struct XRecord<type>                                                                            \
+{                                                                                               \
+    typedef type Type;                                                                          \
+                                                                                                \
+    static_assert(XRecordOrdered(0, sizeof(type), alignof(type) fields(XRECORD_ORDER)),         \
+                  "XRECORD must list all members of " #type " in declaration order");           \
+                                                                                                \
+    enum                                                                                        \
+    {                                                                                           \
+        Size = 0 fields(XRECORD_SIZE),                                                          \
+        Raw = (!XRECORD_BIG_ENDIAN) && (Size == sizeof(type)) fields(XRECORD_RAW)               \
+    };                                                                                          \
+                                                                                                \
+    static const XField *Fields()                                                               \
+    {                                                                                           \
+        static const XField list[] = { fields(XRECORD_FIELD) { 0, 0, 0 } };                     \
+        return list;                                                                            \
+    }                                                                                           \
+};
+
+
+/******************************************************************************
+ * User API
+ ******************************************************************************/
+
+/**
+ * @brief Encode a field from SRAM into its canonical bytes
+ *
+ * @param field description of the field
+ * @param value first byte of the field on SRAM
+ * @param media first byte of the encoded field
+ * @retval None
+ */
+inline void XEncodeField(const XField *field, const uint8_t *value, uint8_t *media)
+{
+    uint8_t width = XRECORD_WIDTH(field->width);
+    uint8_t fill = 0x00;
+
+    for (uint8_t i=0; i<width; i++)
+    {
+        if (i < field->size) media[i] = value[XRECORD_BIG_ENDIAN ? field->size-1-i : i];
+        else media[i] = fill;
+
+        /// Signed fields wider on media extend the most significant byte on SRAM
+        if ((field->width < 0) && (i+1 == field->size) && (media[i] & 0x80)) fill = 0xFF;
+    }
+}
+
+/**
+ * @brief Decode a field from its canonical bytes into SRAM
+ *
+ * @param field description of the field
+ * @param media first byte of the encoded field
+ * @param value first byte of the field on SRAM
+ * @retval None
+ */
+inline void XDecodeField(const XField *field, const uint8_t *media, uint8_t *value)
+{
+    uint8_t width = XRECORD_WIDTH(field->width);
+    uint8_t fill = ((field->width < 0) && (media[width-1] & 0x80) ? 0xFF : 0x00);
+
+    for (uint8_t i=0; i<field->size; i++)
+        value[XRECORD_BIG_ENDIAN ? field->size-1-i : i] = (i < width ? media[i] : fill);
+}
+
+/**
+ * @brief Encode an item into XRecord<X>::Size canonical bytes
+ *
+ * @param item item on SRAM
+ * @param media caller buffer of the encoded item
+ * @retval None
+ */
+template <class X> void XRecordEncode(const X *item, uint8_t *media)
+{
+    const XField *field;
+
+    if (XRecord<X>::Raw)
+    {
+        memcpy(media, item, XRecord<X>::Size);
+        return;
+    }
+
+    for (field = XRecord<X>::Fields(); field->size; field++)
+    {
+        XEncodeField(field, (const uint8_t *) item + field->offset, media);
+        media += XRECORD_WIDTH(field->width);
+    }
+}
+
+/**
+ * @brief Decode an item from XRecord<X>::Size canonical bytes
+ *
+ * @param media encoded item
+ * @param item caller item on SRAM
+ * @retval None
+ */
+template <class X> void XRecordDecode(const uint8_t *media, X *item)
+{
+    const XField *field;
+
+    if (XRecord<X>::Raw)
+    {
+        memcpy(item, media, XRecord<X>::Size);
+        return;
+    }
+
+    for (field = XRecord<X>::Fields(); field->size; field++)
+    {
+        XDecodeField(field, media, (uint8_t *) item + field->offset);
+        media += XRECORD_WIDTH(field->width);
+    }
+}
+
+#endif /* XRecord_H_ */
@@ -37,6 +37,7 @@
 
 
 #include "XEEPROM/XEEPROM.h"
+#include "XRecord.h"
 
 #ifndef XTable_H_
 #define XTable_H_
@@ -45,6 +46,20 @@
 #define NULL 0
 #endif
 
+/// Marker of a sealed resident buffer (see XTable::Seal)
+#define XRESIDENT_MAGIC 0x58544253UL
+
+/// Default items are kept on flash (PROGMEM) on AVR and as plain const data elsewhere
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define XTABLE_READ_DEFAULT(item, address) memcpy_P(item, address, sizeof(X))
+#else
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#define XTABLE_READ_DEFAULT(item, address) memcpy(item, address, sizeof(X))
+#endif
+
 
 template <class X> class XTable
 {
@@ -52,6 +67,42 @@ template <class X> class XTable
 
     const unsigned char BMK = 0x42;
     const unsigned char EMK = 0x45;
+    const unsigned char XMK = 0x58;
+
+    /// Storage modes flags (see InitStorage)
+    enum StorageMode
+    {
+        LEGACY_STORAGE  = 0x00,     ///< AVR101 format: single byte status buffer, counter before top data
+        BITCLEAR_STATUS = 0x01,     ///< Status buffer encoding moving bits from 1 to 0 only between erases
+        WEAR_TELEMETRY  = 0x02,     ///< Extended header keeps counters of stored items (see WearReport)
+        SNAPSHOT_HASH   = 0x04,     ///< Extended header keeps a hash of each stored collection (see SaveStorage)
+        SCHEMA_VERSION  = 0x08,     ///< Extended header keeps version and size of stored items (see SetSchema)
+        PORTABLE_RECORDS = 0x10,    ///< Items stored with the portable encoding of XRecord<X> (see XRecord.h)
+        PACKED_RECORDS  = 0x20,     ///< Items stored without enabled flag and padding of XItem<X>
+        COMPRESSED_RECORDS = 0x40,  ///< Items stored as delta from the previous one with run length encoding
+        DELTA_SNAPSHOTS = 0x80      ///< Only changed items stored as patches of the previous collection (see SetDeltaChain)
+    };
+
+    /// General structure to encapsulate each element with their <status> and <id>
+    template <typename Y>
+    struct XItem
+    {
+        Y item;
+        bool enabled;
+    };
+
+    /// Reference to an inserted item: generation (high byte, never 0) and slot of the runtime list
+    typedef uint32_t Handle;
+
+    /// Wear telemetry of the storage (see WearReport)
+    struct WearInfo
+    {
+        unsigned long saves;            ///< Collections of items stored since the format
+        unsigned long items;            ///< Items stored since the format
+        unsigned long bytes;            ///< Bytes written since the format (items and status)
+        unsigned long max_cycles;       ///< Estimated write cycles of the most worn location
+        unsigned long remaining_saves;  ///< Projected storing operations up to XEEPROM_ENDURANCE
+    };
 
     /// Default constructor
     XTable();
@@ -74,15 +125,20 @@ template <class X> class XTable
      *
      * This method provides CRUD operation to create new data
      * at the end of current table. It creates specified item into runtime
-     * list on SRAM. Automatic index (positive integer) is assigned
-     * to the new entry providing quicker access to data. The index
-     * increase of 1 unit last available id on current table.
+     * list on SRAM. A handle (see Handle) is assigned to the new entry
+     * providing quicker access to data: Select, Update and Delete reach
+     * the entry through its handle in constant time, without moving
+     * current table position.\n
+     *
+     * Handles are valid up to the deletion of the entry. Clean, LoadStorage
+     * and SelectProfile invalidate all of them.
      *
      * @param X specify the new entry to add into the table
+     * @param handle caller handle of the new entry (NULL if not required)
      * @retval true successfully created the new entry
      * @retval false unsuccess. Required entry cannot be created
      */
-    bool Insert(X item);
+    bool Insert(X item, Handle *handle = NULL);
     
     /**
      * @brief Method to read current item on the table.
@@ -120,6 +176,36 @@ template <class X> class XTable
      */
     bool Delete();
 
+    /**
+     * @brief Method to read the item of specified handle (see Insert)
+     *
+     * @param handle handle of the entry
+     * @retval X entry of the handle
+     * @retval NULL for stale or wrong handle
+     */
+    X* Select(Handle handle);
+
+    /**
+     * @brief Method to update the item of specified handle (see Insert)
+     *
+     * @param handle handle of the entry
+     * @param X specify the new entry to update into the table
+     * @retval true successfully updated the entry
+     * @retval false unsuccess. Stale or wrong handle
+     */
+    bool Update(Handle handle, X item);
+
+    /**
+     * @brief Method to delete the item of specified handle (see Insert)
+     *
+     * The handle becomes stale, as well as any copy of it.
+     *
+     * @param handle handle of the entry
+     * @retval true successfully deleted the entry
+     * @retval false unsuccess. Stale or wrong handle
+     */
+    bool Delete(Handle handle);
+
     /**
      * @brief Method to remove all available entries from the table
      *
@@ -169,6 +255,62 @@ template <class X> class XTable
      */
     bool Next();
 
+    /**
+     * @brief Method to read the item at specified position of the table
+     *
+     * Positions follow the order of Top and Next (0 for the first item). The item is
+     * reached in constant time up to the first hole of the runtime list (deleted item),
+     * so on any table without holes, and in logarithmic time beyond it through a rank
+     * index of the slots (built on demand, 2 bytes every 8 slots on AVR).\n
+     *
+     * Current table position does not change, except with default items on flash
+     * (see InitDefaults), which are walked from the top as through Seek.
+     *
+     * @param index position of the item (0 .. Counter()-1)
+     * @retval X entry at specified position
+     * @retval NULL for wrong position
+     */
+    X* At(unsigned int index);
+
+    /**
+     * @brief Method to move current table position to specified position
+     *
+     * Same as Top followed by <index> calls of Next, in the time of At.
+     *
+     * @param index position of the item (0 .. Counter()-1)
+     * @retval true successfully moved to the item
+     * @retval false unsuccess. Wrong position
+     */
+    bool Seek(unsigned int index);
+
+    /**
+     * @brief Method to set a collection of default items kept on flash as current table
+     *
+     * Default items are read from flash as they are walked (see Top and Next) and
+     * each of them is copied to a slot of the runtime list on SRAM only once it
+     * is updated (copy-on-write). Items inserted later follow the default ones.
+     * Storing operations read the default items not updated straight from flash
+     * (see SaveStorage), so the buffer holds only updated and inserted items.
+     * Each profile keeps its own default items (see SelectProfile) and tables
+     * with default items are not sealed (see Seal).
+     * Clean and LoadStorage drop the default items.\n
+     *
+     * Changes of a default item are expected through Update: the pointer returned
+     * by Select refers to a temporary copy of the item.
+     *
+     * @code
+     * const T_LED default_LEDs[] PROGMEM = { { 2, false, 500 }, { 3, false, 500 } };
+     *
+     * leds.InitDefaults(default_LEDs, 2);
+     * @endcode
+     *
+     * @param items array of default items (PROGMEM on AVR)
+     * @param count number of default items (up to 255)
+     * @retval true table made of the default items
+     * @retval false unsuccess. Buffer not initialized or larger than 254 items
+     */
+    bool InitDefaults(const X *items, int count);
+
     /**
      * @brief Method to format specified EEPROM area for circular buffer management.
      *
@@ -191,6 +333,9 @@ template <class X> class XTable
      * Please consider the Atmel Application Note AVR101 "High Endurance EEPROM Storage" for more
      * details about this implementation.
      *
+     * Only the header is written while formatting. Parameter locations are don't-care until
+     * stored, so formatting time does not depend on the size of the items.
+     *
      * @param start_location describe the start EEPROM address of the circular buffer
      * @param max_items describe maximum number of entries for the table
      * @retval true EEPROM successfully formatted. Specified area is ready for circular management
@@ -198,13 +343,98 @@ template <class X> class XTable
      */
     bool InitStorage(int start_location, int max_items);
 
+    /**
+     * @brief Method to format specified EEPROM area for circular buffer management with specified mode.
+     *
+     * This method works as InitStorage above. Any mode other than LEGACY_STORAGE uses an extended
+     * header where the mode is stored and each status location keeps the counter of its stored items.\n
+     *
+     * Extended memory structure:
+     * <table border="0">
+     * <tr><th></th><th>HEADER</th><th></th><th></th><th></th><th>DATA</th></tr>
+     * <tr><th>Marker</th><td>Buf.Size</td><td>Mode</td><td>Status Buffer</td><td>Marker</td><td>Parameter Buffer</td></tr>
+     * <tr><th>(0x58)</th><td>(<size>)</td><td>(<mode>)</td><td>(x,n) (x,n) ... (x,n)</td><td>(0x45)</td><td>(<data>) ... (<data>)</td></tr>
+     * </table>
+     *
+     * Where "(x,n)" is the status value and the counter of items stored from the related location.\n
+     *
+     * With BITCLEAR_STATUS mode, the status value of each location only moves bits from 1 to 0
+     * (0xFF, 0x7F, 0x3F ... 0x00) along each round of the circular buffer and back to 0xFF
+     * at the next one. Each status update is then a single write-only or erase-only cycle,
+     * about half of an atomic cycle, on devices providing split cycles (see XEEPROM_SPLIT_CYCLES,
+     * enabled by default where available); otherwise each of them is still an atomic cycle.\n
+     *
+     * With WEAR_TELEMETRY mode, 8 bytes of wear counters follow the end marker (see WearReport).
+     * With SCHEMA_VERSION mode, 3 more bytes keep version and size of stored items (see SetSchema).
+     * With SNAPSHOT_HASH mode, 4 bytes for each location keep the hash of the collection stored
+     * from there (see SaveStorage).
+     * With PORTABLE_RECORDS mode, each item is stored as its portable encoding (see XRecord.h)
+     * followed by the enabled flag (1 byte), so the storage is read back by any target.
+     * With PACKED_RECORDS mode, items are stored back to back without the enabled flag and
+     * the padding of XItem: only enabled items are stored and the counter of the status
+     * entry already tells how many of them follow the top location.
+     * With COMPRESSED_RECORDS mode, the stored bytes of each item are replaced by their delta from
+     * the previous item: token 0x80 is followed by a bitmap of the non-zero bytes of a new delta and
+     * by those bytes, tokens 0x00 .. 0x7F repeat the last delta for 1 .. 128 items. Repetitive tables
+     * are stored with a few bytes and up to 255 items fit as long as their stream fits into the
+     * parameter buffer.
+     * With DELTA_SNAPSHOTS mode, 1 byte for each location follows the hashes, if any: 0xFF for a
+     * full collection stored from there, otherwise the position of the single item patched by the
+     * location (see SetDeltaChain).
+     *
+     * @param start_location describe the start EEPROM address of the circular buffer
+     * @param max_items describe maximum number of entries for the table
+     * @param mode combination of StorageMode flags
+     * @retval true EEPROM successfully formatted. Specified area is ready for circular management
+     * @retval false unsuccess. Required storage cannot be prepared because of size or unavailable EEPROM
+     */
+    bool InitStorage(int start_location, int max_items, uint8_t mode);
+
+    /**
+     * @brief Method to format the EEPROM region planned by a compile-time layout.
+     *
+     * This method works as InitStorage above on the I-th region of the layout L
+     * (see XLayout.h). Start address, size and mode of the region are resolved at compile
+     * time and the region must describe items of this table.
+     *
+     * @param L layout of the EEPROM regions (XLayout)
+     * @param I index of the region within the layout
+     * @retval true EEPROM successfully formatted. Specified area is ready for circular management
+     * @retval false unsuccess. Required storage cannot be prepared because of unavailable EEPROM
+     */
+    template <class L, int I> bool InitStorage();
+
+    /**
+     * @brief Method to format the whole specified EEPROM area as wear pool of the circular buffer.
+     *
+     * This method works as InitStorage above with the largest circular buffer (up to 255 locations)
+     * fitting from the start to the end location. The top location moves along all of them,
+     * so each location is written less often as the area grows and the number of times the
+     * table can be stored grows in proportion.\n
+     *
+     * The number of locations is kept on the header, so the stored table survives as long
+     * as the same area is specified. Any other area formats the storage again.
+     *
+     * @param start_location describe the start EEPROM address of the circular buffer
+     * @param end_location describe the last EEPROM address available to the circular buffer
+     * @param mode combination of StorageMode flags
+     * @retval true EEPROM successfully formatted. Specified area is ready for circular management
+     * @retval false unsuccess. Specified area cannot keep as many locations as the buffer on SRAM
+     */
+    bool InitPoolStorage(int start_location, int end_location = XEEPROM_END, uint8_t mode = LEGACY_STORAGE);
+
 
     /**
      * @brief Method to store current collection of items from the SRAM to the circular EEPROM storage.
      *
      * This method allow to store current items available inside the table into the already formatted
      * circular EEPROM storage. It allow to use the same EEPROM area improving the number of times the
-     * data can be stored until to twice the expected limit through static approach.
+     * data can be stored until to twice the expected limit through static approach.\n
+     *
+     * With SNAPSHOT_HASH mode, the hash of current items is compared with the one of the last
+     * stored collection and an unchanged table is not stored again (no EEPROM write at all).
+     * With COMPRESSED_RECORDS mode, a table whose stream does not fit into the parameter buffer
+     * is not stored (the previous collection is kept).
      *
      * @param all_items pointer allocating the table. Pointer to the runtime list on SRAM
      * @retval true table stored into the EEPROM as expected
@@ -212,6 +442,84 @@ template <class X> class XTable
      */
     bool SaveStorage();
 
+    /**
+     * @brief Method to set the write-back policy of RequestSave
+     *
+     * Requests received within the window from the first pending one are coalesced into a
+     * single storing operation. No more than <max_saves> storing operations are performed
+     * for each period, further requests wait for the next period.
+     * Without policy (default) each request is stored at once.
+     *
+     * @param window_ms coalescing window (0 for none)
+     * @param max_saves maximum storing operations for each period (0 for unlimited)
+     * @param period_ms period of the persistence budget (i.e. 3600000UL for one hour)
+     * @retval None
+     */
+    void SetSavePolicy(unsigned long window_ms, unsigned int max_saves = 0, unsigned long period_ms = 0);
+
+    /**
+     * @brief Method to request storing of current collection of items through the write-back policy
+     *
+     * This method marks the table to be stored and calls FlushStorage(now). Any request
+     * coalesced with a pending one is counted as avoided storing operation.
+     *
+     * @param now current time in milliseconds (i.e. millis())
+     * @retval true table stored or nothing pending
+     * @retval false storing operation pending or failed
+     */
+    bool RequestSave(unsigned long now);
+
+    /**
+     * @brief Method to perform the pending storing operation when the write-back policy allows it
+     *
+     * This method is meant to be called periodically (i.e. from the loop function).
+     * Only storing operations writing the EEPROM are charged to the budget: an unchanged
+     * table (see SNAPSHOT_HASH) counts as avoided storing operation and a failed one is
+     * retried at the next call.
+     *
+     * @param now current time in milliseconds (i.e. millis())
+     * @retval true table stored or nothing pending
+     * @retval false storing operation pending or failed
+     */
+    bool FlushStorage(unsigned long now);
+
+    /**
+     * @brief Method to force the pending storing operation regardless of window and budget
+     *
+     * This method is meant for orderly shutdown or explicit requests of the user.
+     *
+     * @param None
+     * @retval true table stored or nothing pending
+     * @retval false unsuccess. Items cannot be stored into expected EEPROM area
+     */
+    bool FlushStorage();
+
+    /**
+      * @brief Method to get the number of storing operations avoided by the write-back policy
+      *
+      * @param None
+      * @retval number of requests coalesced with a pending one or found already stored (see SNAPSHOT_HASH)
+      */
+    unsigned long AvoidedSaves();
+
+    /**
+     * @brief Method to set the maximum chain of patches stored with DELTA_SNAPSHOTS mode
+     *
+     * When the number of items is unchanged, SaveStorage compares each item with its stored
+     * version and moves the top location once for each changed item only. The new location
+     * keeps the position of the item and the item itself is stored into the parameter location
+     * following the last one used by the chain, so the base collection is never overwritten.
+     * LoadStorage reads the base collection and applies the patches in order.\n
+     *
+     * A full collection is stored when items are inserted or deleted, when the chain would
+     * exceed the maximum or when the base collection and the patches do not fit into the buffer.
+     * Compressed items (COMPRESSED_RECORDS) are always stored as full collections.
+     *
+     * @param max_patches maximum number of patches following a full collection (0 for none)
+     * @retval None
+     */
+    void SetDeltaChain(uint8_t max_patches);
+
     /**
      * @brief Method to copy current collection of items from circular EEPROM storage to the runtime list on SRAM
      *
@@ -223,6 +531,41 @@ template <class X> class XTable
      */
     bool LoadStorage();
 
+    /**
+     * @brief Method to erase in advance the EEPROM locations of the next storing operation
+     *
+     * This method is meant to be called during idle time. The next SaveStorage writes
+     * the status location following the top one and the parameter locations from there on.
+     * All of these locations not keeping the last stored collection of items are erased,
+     * so that the next SaveStorage programs them through write-only cycles (about half
+     * the time of an atomic erase and write cycle on AVR devices providing EEPM bits).
+     * Default items on flash are read as they are (see InitDefaults).\n
+     *
+     * Devices without erase-only cycles (see XEEPROM_SPLIT_CYCLES) would spend a whole
+     * atomic cycle for each erased location, so nothing is erased and false is returned.
+     *
+     * @param None
+     * @retval true EEPROM locations erased as expected
+     * @retval false unsuccess. Storage unformatted as expected or split cycles not available
+     */
+    bool PreEraseStorage();
+
+    /**
+     * @brief Method to walk current collection of items directly on the circular EEPROM storage
+     *
+     * This method reads the last stored collection of items one by one, following the
+     * circular buffer from its top location, without copying them to the runtime list on SRAM.
+     * Each entry is decoded into the caller buffer and passed to the callback function.
+     * The walk stops as soon as the callback returns false.
+     *
+     * @param buffer pointer to the caller buffer used to decode each stored entry
+     * @param callback function called for each stored entry (return false to stop the walk)
+     * @param context optional pointer forwarded to the callback function
+     * @retval true all stored entries walked as expected
+     * @retval false unsuccess. Unformatted storage or walk stopped by the callback
+     */
+    bool ForEachStored(XItem<X> *buffer, bool (*callback)(XItem<X> *buffer, void *context), void *context = NULL);
+
     /**
       * @brief Method to get the top address of the area reserved to raw data or parameters
       *
@@ -239,13 +582,150 @@ template <class X> class XTable
       */
     int NextFreeAddressStorage();
 
-    /// General structure to encapsulate each element with their <status> and <id>
-    template <typename Y>
-    struct XItem
-    {
-        Y item;
-        bool enabled;
-    };
+    /**
+      * @brief Method to get the size of the EEPROM area required by a storage
+      *
+      * It is a constant expression, so it also sizes EEPROM regions at compile time (see XLayout.h).
+      *
+      * @param max_items describe maximum number of entries for the table
+      * @param mode combination of StorageMode flags
+      * @retval size of the storage (header and data) in bytes
+      */
+    static constexpr int SizeStorage(int max_items, uint8_t mode = LEGACY_STORAGE);
+
+    /**
+      * @brief Method to get the size of the header of a storage (markers, status buffer and extended header)
+      *
+      * @param max_items describe maximum number of entries for the table
+      * @param mode combination of StorageMode flags
+      * @retval size of the header in bytes, that is the offset of the first parameter location
+      */
+    static constexpr int HeaderSize(int max_items, uint8_t mode);
+
+    /**
+      * @brief Method to get the size of each stored item
+      *
+      * @param mode combination of StorageMode flags
+      * @retval size of each parameter location in bytes
+      */
+    static constexpr int RecordSize(uint8_t mode);
+
+    /**
+     * @brief Method to get the wear telemetry of a storage formatted with WEAR_TELEMETRY mode
+     *
+     * Two counters follow the end marker of the extended header: the collections and the items
+     * stored up to the last round of the circular buffer. They are updated once per round, when
+     * the top location moves back to the first one, so that each of their locations wears as
+     * a status location does. Items of the current round come from the counters of the status
+     * buffer.\n
+     *
+     * Each status location is written once per round and each parameter location once
+     * per stored item on average, so the most worn location is estimated as the largest
+     * of saves/<size> and items/<size>. Remaining saves are projected at the same rate
+     * up to XEEPROM_ENDURANCE cycles, through 8.8 fixed point arithmetic (no float code
+     * on AVR, within 1/256 of the exact projection).\n
+     *
+     * Items and bytes count what is actually written: a patch of DELTA_SNAPSHOTS mode is
+     * a single item, and each save also writes its hash (SNAPSHOT_HASH) and patch index
+     * (DELTA_SNAPSHOTS). Compressed items (COMPRESSED_RECORDS) are counted at their full size.
+     *
+     * @param report pointer to the caller structure filled with the telemetry
+     * @retval true telemetry read as expected
+     * @retval false unsuccess. Storage unformatted or formatted without WEAR_TELEMETRY mode
+     */
+    bool WearReport(WearInfo *report);
+
+    /**
+     * @brief Method to dump the wear telemetry as a single line of comma separated values
+     *
+     * Line format:\n
+     * XWEAR,<start>,<size>,<mode>,<saves>,<items>,<bytes>,<max cycles>,<remaining saves>
+     *
+     * @param output any stream providing print and println methods (i.e. Serial)
+     * @retval true telemetry printed as expected
+     * @retval false unsuccess. Telemetry unavailable (see WearReport)
+     */
+    template <class P> bool PrintWearReport(P &output);
+
+    /**
+     * @brief Method to set the schema of the items stored with SCHEMA_VERSION mode
+     *
+     * The version declared by the sketch and the size of XItem<X> are kept on the header
+     * of the storage. LoadStorage does not copy items stored with a different schema as they
+     * are: each of them is decoded into its own location of the runtime list on SRAM
+     * and the migration function upgrades it in place. Raw items keep the bytes of the
+     * previous XItem, while PORTABLE_RECORDS and PACKED_RECORDS items are decoded with the
+     * current layout from the previous encoding zero extended (fields appended at the end
+     * of X are read as 0). The next SaveStorage formats the storage again with current
+     * schema before storing.\n
+     *
+     * Stored items larger than the current stored item cannot be migrated in place.
+     *
+     * @param version schema version of current items (i.e. increased at any change of X)
+     * @param migrate function upgrading a stored record in place (return false to reject it)
+     * @retval None
+     */
+    void SetSchema(uint8_t version, bool (*migrate)(uint8_t stored_version, XItem<X> *record, unsigned int stored_size) = NULL);
+
+    /**
+     * @brief Initialize resident profiles of the table on SRAM
+     *
+     * Each profile keeps its own runtime list on SRAM (same size of the buffer) and its own
+     * EEPROM storage settings. Current runtime list and storage become the profile 0.
+     * Runtime list of any other profile is created on demand, the first time it is selected.
+     *
+     * @param profiles_number specify number of profiles (2 .. 255)
+     * @retval true successfully created profiles
+     * @retval false unsuccess. Buffer not initialized or profiles already created
+     */
+    bool InitProfiles(int profiles_number);
+
+    /**
+     * @brief Method to select the active profile of the table
+     *
+     * This method switches runtime list and EEPROM storage settings of the table to
+     * specified profile. Resident profiles are switched without any access to EEPROM.
+     * Each profile keeps its own default items on flash (see InitDefaults).
+     * All the other methods work on the active profile.
+     *
+     * @param profile specify the profile to activate
+     * @retval true successfully selected profile
+     * @retval false unsuccess. Unknown profile or runtime list cannot be created
+     */
+    bool SelectProfile(int profile);
+
+    /**
+      * @brief Method to get the active profile of the table
+      *
+      * @param None
+      * @retval active profile (0 without profiles)
+      */
+    int CurrentProfile();
+
+    /**
+     * @brief Method to store the active profile into a wear leveled EEPROM slot
+     *
+     * The slot is a short EEPROM area written one byte further at each change of selection.
+     * Erased bytes (0xFF) follow the last written one, so each change is a single write-only
+     * cycle where available (see XEEPROM_SPLIT_CYCLES) and the whole slot is erased once every
+     * <size> changes.
+     *
+     * @param start_location describe the start EEPROM address of the slot
+     * @param size describe the size of the slot
+     * @retval true active profile stored as expected
+     * @retval false unsuccess. Wrong slot
+     */
+    bool SaveProfile(int start_location, int size);
+
+    /**
+     * @brief Method to get the profile stored into a wear leveled EEPROM slot (see SaveProfile)
+     *
+     * @param start_location describe the start EEPROM address of the slot
+     * @param size describe the size of the slot
+     * @retval profile stored into the slot
+     * @retval -1 unsuccess. Wrong or empty slot
+     */
+    int LoadProfile(int start_location, int size);
 
     /// Shared instance of pointer to manage the Arduino EEPROM
     XItem<X> *xitem;
@@ -254,81 +734,349 @@ template <class X> class XTable
 
   private:
 
-    /// General structure to encapsulate each element of the table into runtime list on SRAM
-    template <typename Y>
-    struct Item
+    /// Log-structured storage on NOR flash (see XFlash.h)
+    template <class Y> friend class XFlashTable;
+
+    /// Bytes of a stored item on SRAM (any storage mode)
+    enum { RECORD_BUFFER = (sizeof(XItem<X>) > XRecord<X>::Size + 1 ? sizeof(XItem<X>) : XRecord<X>::Size + 1) };
+
+    /// Compressed items (see COMPRESSED_RECORDS)
+    enum StreamOperation { STREAM_LENGTH, STREAM_STORE, STREAM_PREERASE };
+
+    struct Stream
     {
-        Y item;
-        bool enabled;
-        Item<Y> *next;
+        int location;                   ///< Next byte of the stream
+        int length;                     ///< Bytes of the stream up to the location
+        int erase_begin;                ///< First byte to pre-erase (STREAM_PREERASE)
+        int erase_end;                  ///< Byte beyond the last one to pre-erase
+        uint8_t run;                    ///< Items of the current run
+        uint8_t previous[RECORD_BUFFER];
+        uint8_t delta[RECORD_BUFFER];
     };
 
     unsigned int counter;
     unsigned int buffer_max_items;
 
-    Item<X> *first_record;
-    Item<X> *current_record;
-    Item<X> *new_record;
+    /// Runtime list on SRAM: contiguous slots with the same layout of the stored items
+    XItem<X> *first_record;
+    XItem<X> *last_record;
+    XItem<X> *current_record;
+
+    /// Runtime context of each resident profile (active one lives on the members of the table)
+    struct Profile
+    {
+        unsigned int counter;
+        XItem<X> *first_record;
+        XItem<X> *current_record;
+        int eeprom_header_begin;
+        int eeprom_status_begin;
+        int eeprom_status_size;
+        int eeprom_parameter_begin;
+        int eeprom_max_items;
+        uint8_t eeprom_mode;
+        int top_status_ptr;
+        int top_parameter_ptr;
+        bool save_pending;
+        unsigned long save_pending_since;
+        const X *defaults;
+        int defaults_count;
+        int current_default;
+        uint8_t *overlay;
+        uint8_t *overlay_slots;
+    };
+
+  public:
+
+    /// Context of a runtime list kept across soft resets (see Resident)
+    struct ResidentHeader
+    {
+        uint32_t magic;
+        uint32_t generation;            ///< Seals since the cold start
+        uint32_t checksum;
+        Profile context;
+    };
+
+    /**
+     * @brief Runtime list on SRAM kept across soft resets
+     *
+     * It is expected out of the memory initialized at startup
+     * (i.e. __attribute__((section(".noinit"))) on AVR).
+     *
+     * @param MAX_ITEMS maximum number of entries for the table
+     */
+    template <int MAX_ITEMS>
+    struct Resident
+    {
+        ResidentHeader header;
+        XItem<X> records[MAX_ITEMS];
+    };
+
+    /**
+     * @brief Initialize buffer on SRAM kept across soft resets (i.e. watchdog reset)
+     *
+     * A buffer sealed before the reset is checked in a single pass (marker and checksum)
+     * and adopted together with its storage context, without any EEPROM access.
+     * Otherwise the buffer starts empty as through InitBuffer(MAX_ITEMS).
+     *
+     * @param buffer runtime list out of the memory initialized at startup
+     * @retval true table adopted as it was sealed (InitStorage and LoadStorage not required)
+     * @retval false cold start or buffer already initialized
+     */
+    template <int MAX_ITEMS> bool InitBuffer(Resident<MAX_ITEMS> *buffer);
+
+    /**
+     * @brief Method to seal current runtime list into its resident buffer (see InitBuffer)
+     *
+     * LoadStorage and SaveStorage seal the table as well. Any change of the table
+     * discards the seal, so that unsaved changes never survive a reset.
+     * Default items on flash (see InitDefaults) are not kept by the resident buffer,
+     * so the table is not sealed until they are dropped.
+     *
+     * @param None
+     * @retval None
+     */
+    void Seal();
+
+  private:
+
+    Profile *profiles;
+    int profiles_max;
+    int active_profile;
 
     /**< EEPROM Section */
     int eeprom_header_begin;
+    int eeprom_status_begin;
+    int eeprom_status_size;
     int eeprom_parameter_begin;
     int eeprom_max_items;
+    uint8_t eeprom_mode;
     int top_status_ptr;
     int top_parameter_ptr;
 
+    /// Write-back policy (see SetSavePolicy)
+    unsigned long save_window;
+    unsigned long save_period;
+    unsigned int save_budget;
+    unsigned int save_budget_count;
+    unsigned long save_budget_begin;
+    bool save_pending;
+    unsigned long save_pending_since;
+    unsigned long saves_avoided;
+    bool save_written;                  ///< Last SaveStorage wrote the EEPROM (false for an unchanged table)
+
+    /// Maximum patches of a full collection (see SetDeltaChain)
+    uint8_t delta_chain_max;
+
+    /// Runtime list kept across soft resets (see InitBuffer)
+    ResidentHeader *resident;
+
+    /// Default items on flash and their overlay on SRAM (see InitDefaults)
+    const X *defaults;
+    int defaults_count;
+    int current_default;                ///< Default item at the current position (-1 for none)
+    uint8_t *overlay;                   ///< For each default item: 0 as it is, slot+1 once updated, 0xFF deleted
+    uint8_t *overlay_slots;             ///< Bitmap of the slots keeping updated default items
+
+    /// Generation of each slot, moved on as soon as its item is deleted (see Insert)
+    uint8_t *generations;
+
+    /// Positions of the items (see At)
+    unsigned int dense_items;           ///< Leading slots all enabled (lower bound)
+    unsigned int *ranks;                ///< Enabled slots of each block of 8 slots, as Fenwick tree
+    unsigned int ranks_blocks;
+    bool ranks_valid;
+
+    /// Schema of stored items (see SetSchema)
+    uint8_t schema_version;
+    bool (*schema_migrate)(uint8_t stored_version, XItem<X> *record, unsigned int stored_size);
+
     void Init();
 
     int IncCurrentLocation(int curr_location);
 
+    int DecCurrentLocation(int curr_location);
+
+    int GetIndexFromStatus(int curr_location);
+
     int GetLocationFromStatus(int curr_location);
 
+    int GetCounterLocation(int curr_location);
+
+    int GetEndMarkerLocation();
+
+    bool CheckMarkers();
+
     void GetTopLocation();
 
     void PutTopLocation();
 
-    /**
-     * @brief Method to check the format of the storage and get current start point of circular buffer.
-     *
-     * This method check specified EEPROM as expected for circular buffer storage. It checks both markers
-     * of the header section considering maximum number of specified entries.
-     *
-     * @param start_location describe the start EEPROM address of the circular buffer
-     * @param max_items describe maximum number of entries for the table
-     * @retval true EEPROM well defined. Specified area is formated as expected
-     * @retval false unsuccess. Required storage is unformatted as expected
-     */
-    bool CheckStorage();
-};
+    int GetWearLocation();
 
+    uint8_t GetWrittenItems(int curr_status_ptr);
 
-/******************************************************************************
- * User API
- ******************************************************************************/
+    unsigned long ReadLong(int location);
 
-template <class X> XTable<X>::XTable()
-{
-    // Initialize main global list pointers
-    Init();
+    void WriteLong(int location, unsigned long value);
 
-    //current_free_record = NULL;
-    first_record = NULL;
+    void PutWearCounters();
+
+    int GetSchemaLocation();
+
+    int GetHashLocation(int curr_location);
+
+    uint32_t GetSnapshotHash();
+
+    bool RawRecords();
+
+    uint8_t *EncodeRecord(XItem<X> *record, uint8_t *media);
+
+    void DecodeRecord(uint8_t *media, XItem<X> *record);
+
+    void PutRecords(int location, XItem<X> *record, int count);
+
+    void GetRecords(int location, XItem<X> *record, int count);
+
+    void OpenStream(Stream *stream, int location);
+
+    void PutStreamByte(Stream *stream, uint8_t value, uint8_t operation);
+
+    uint8_t GetStreamByte(Stream *stream);
+
+    int PutStream(int location, uint8_t operation, int erase_begin = 0, int erase_end = 0);
+
+    void GetStream(Stream *stream, XItem<X> *record);
+
+    void PreEraseStream(int next_status_ptr, uint8_t count);
+
+    int GetDeltaLocation(int curr_location);
+
+    int GetDeltaDepth(int *base_status_ptr);
+
+    int GetSlotLocation(int index);
+
+    int GetItemLocation(uint8_t idx, uint8_t count, int depth);
+
+    bool IsStoredItem(XItem<X> *record, int location);
+
+    bool PutDelta();
+
+    void PreEraseLocation(int location, uint8_t next_value);
+
+    void FormatStorage();
+
+    bool CheckSchema();
+
+    bool MigrateStorage(uint8_t count);
+
+    void StoreProfile(Profile *profile);
+
+    uint32_t GetResidentHash();
+
+    void Unseal();
+
+    void DeleteList(XItem<X> *list);
+
+    bool SelectDefault(int index);
+
+    bool IsOverlaySlot(XItem<X> *record);
+
+    void DropDefaults();
+
+    XItem<X> *GetHandleRecord(Handle handle);
+
+    void RetireHandle(XItem<X> *record);
+
+    void RetireHandles();
+
+    void EnableSlot(XItem<X> *record, bool enabled);
+
+    XItem<X> *GetRankRecord(unsigned int index);
+
+    bool BuildRanks();
+
+    XItem<X> *GetStoredRecord(int *position, XItem<X> *buffer);
+
+    void RestoreProfile(Profile *profile);
+
+    int GetProfileLocation(int start_location, int size);
+
+    /**
+     * @brief Method to check the format of the storage and get current start point of circular buffer.
+     *
+     * This method check specified EEPROM as expected for circular buffer storage. It checks both markers
+     * of the header section considering maximum number of specified entries.
+     *
+     * @param start_location describe the start EEPROM address of the circular buffer
+     * @param max_items describe maximum number of entries for the table
+     * @retval true EEPROM well defined. Specified area is formated as expected
+     * @retval false unsuccess. Required storage is unformatted as expected
+     */
+    bool CheckStorage();
+};
+
+
+/******************************************************************************
+ * User API
+ ******************************************************************************/
+
+template <class X> XTable<X>::XTable()
+{
+    // Initialize main global list pointers
+    Init();
+
+    first_record = NULL;
+    last_record = NULL;
+    xitem = NULL;
+
+    profiles = NULL;
+    profiles_max = 0;
+    active_profile = 0;
+
+    resident = NULL;
+
+    defaults = NULL;
+    defaults_count = 0;
+    overlay = NULL;
+    overlay_slots = NULL;
+
+    generations = NULL;
+
+    ranks = NULL;
+    ranks_blocks = 0;
 
     // Flag for InitStorage process
     eeprom_max_items = -1;
+    eeprom_mode = LEGACY_STORAGE;
+
+    // Unversioned items without migration
+    SetSchema(0);
+
+    // Short chains of patches
+    SetDeltaChain(8);
+
+    // Each request stored at once
+    SetSavePolicy(0);
+    save_pending = false;
+    saves_avoided = 0;
+    save_written = false;
 }
 
 template <class X> XTable<X>::~XTable()
 {
-	current_record = first_record;
-
-	while (current_record)
-	{
-	   new_record = current_record->next;
-	   delete current_record;
-	   current_record = new_record;
-	}
-
+	for (int profile=0; profile<profiles_max; profile++)
+		if (profile != active_profile)
+		{
+			DeleteList(profiles[profile].first_record);
+			delete[] profiles[profile].overlay;
+			delete[] profiles[profile].overlay_slots;
+		}
+
+	delete[] profiles;
+	DeleteList(first_record);
+	DropDefaults();
+	delete[] generations;
+	delete[] ranks;
+	delete xitem;
 }
 
 
@@ -336,73 +1084,136 @@ template <class X> XTable<X>::~XTable()
 template <class X> void XTable<X>::Init()
 {
     current_record = NULL;
-    new_record = NULL;
+    current_default = -1;
     counter = 0;
+    dense_items = 0;
+    ranks_valid = false;
 }
 
 template <class X> bool XTable<X>::InitBuffer(int max_items)
 {
-    unsigned int it = 0;
-
     // Buffer already initialized
-    if (first_record) return false;
+    if ((first_record) || (max_items <= 0)) return false;
 
-    first_record = new Item<X>;
+    first_record = new XItem<X>[max_items];
     if (!first_record) return false;
 
-    current_record = first_record;
+    last_record = first_record + max_items;
+    buffer_max_items = max_items;
 
-    do
-    {
-        new_record = new Item<X>;
+    xitem = new XItem<X>;
 
-        current_record->next = new_record;
-        current_record = new_record;
-        it++;
-    } while ((new_record != NULL) && (it < max_items));
+    Clean();
 
-    if (it < max_items) return false;
+    return true;
+}
 
-    current_record->next = NULL;
-    buffer_max_items = max_items;
+template <class X> template <int MAX_ITEMS> bool XTable<X>::InitBuffer(Resident<MAX_ITEMS> *buffer)
+{
+    // Buffer already initialized
+    if (first_record) return false;
+
+    first_record = buffer->records;
+    last_record = first_record + MAX_ITEMS;
+    buffer_max_items = MAX_ITEMS;
+    resident = &buffer->header;
 
     xitem = new XItem<X>;
 
-    return true;
+    /// Sealed table of the same buffer
+    if ((resident->magic == XRESIDENT_MAGIC) && (resident->context.first_record == first_record) &&
+        (resident->context.counter <= buffer_max_items) && (resident->checksum == GetResidentHash()))
+    {
+        RestoreProfile(&resident->context);
+        current_record = NULL;
+        return true;
+    }
+
+    resident->magic = 0;
+    resident->generation = 0;
+    resident->context.first_record = first_record;
+    Clean();
+
+    return false;
+}
+
+template <class X> void XTable<X>::Seal()
+{
+    /// Only the runtime list of the resident buffer (see SelectProfile)
+    if ((!resident) || (resident->context.first_record != first_record) || (defaults)) return;
+
+    StoreProfile(&resident->context);
+    resident->context.current_record = NULL;
+    resident->generation++;
+    resident->checksum = GetResidentHash();
+    resident->magic = XRESIDENT_MAGIC;
 }
 
-template <class X> bool XTable<X>::Insert(X item)
+template <class X> bool XTable<X>::Insert(X item, Handle *handle)
 {
 
-	current_record = first_record;
+	if (!first_record) return false;
 
-	if (current_record)
+	/// Generations on demand, only for sketches using handles
+	if ((handle) && (!generations))
 	{
-		while ((current_record->next) && (current_record->enabled))
-				current_record = current_record->next;
+		generations = new uint8_t[buffer_max_items];
+		if (!generations) return false;
+		memset(generations, 1, buffer_max_items);
+	}
+
+	Unseal();
+	current_record = first_record + dense_items;
 
-		// All available records already used
-		if (!current_record->next) return false;
+	while ((current_record < last_record) && (current_record->enabled))
+			current_record++;
+
+	// All available records already used
+	if (current_record == last_record)
+	{
+		current_record = NULL;
+		return false;
 	}
 
 	// Insert new item
-	current_record->enabled = true;
+	current_default = -1;
+	EnableSlot(current_record, true);
 	current_record->item = item;
     counter++;
 
+    if (handle) *handle = ((Handle) generations[current_record - first_record] << 24) | (current_record - first_record);
+
     return true;
 }
 
 template <class X> X* XTable<X>::Select()
 {
-    if (!current_record->enabled) return NULL;
+    if ((!current_record) || (!current_record->enabled)) return NULL;
     return &(current_record->item);
 }
 
 template <class X> bool XTable<X>::Update(X item)
 {
+    XItem<X> *record;
+
     if (!current_record) return false;
 
+    Unseal();
+
+    /// Copy-on-write of a default item to the first available slot
+    if (current_record == xitem)
+    {
+        if (overlay[current_default] == 0xFF) return false;
+
+        for (record = first_record; (record < last_record) && (record->enabled); record++);
+        if (record == last_record) return false;
+
+        overlay[current_default] = record - first_record + 1;
+        overlay_slots[(record - first_record)/8] |= (1 << ((record - first_record)%8));
+        EnableSlot(record, true);
+        current_record = record;
+    }
+
     current_record->item = item;
     return true;
 }
@@ -411,23 +1222,69 @@ template <class X> bool XTable<X>::Delete()
 {
     if (!current_record) return false;
 
-    current_record->enabled = false;
+    Unseal();
+
+    if (current_default >= 0)
+    {
+        if (overlay[current_default] == 0xFF) return false;
+
+        /// Slot of an updated default item back available
+        if (current_record != xitem)
+        {
+            overlay_slots[(current_record - first_record)/8] &= ~(1 << ((current_record - first_record)%8));
+            EnableSlot(current_record, false);
+        }
+
+        overlay[current_default] = 0xFF;
+        current_record = xitem;
+    }
+
+    RetireHandle(current_record);
+    EnableSlot(current_record, false);
+    counter--;
+    return true;
+}
+
+template <class X> X* XTable<X>::Select(Handle handle)
+{
+    XItem<X> *record = GetHandleRecord(handle);
+
+    if (!record) return NULL;
+    return &(record->item);
+}
+
+template <class X> bool XTable<X>::Update(Handle handle, X item)
+{
+    XItem<X> *record = GetHandleRecord(handle);
+
+    if (!record) return false;
+
+    Unseal();
+    record->item = item;
+    return true;
+}
+
+template <class X> bool XTable<X>::Delete(Handle handle)
+{
+    XItem<X> *record = GetHandleRecord(handle);
+
+    if (!record) return false;
+
+    Unseal();
+    RetireHandle(record);
+    EnableSlot(record, false);
     counter--;
     return true;
 }
 
 template <class X> void XTable<X>::Clean()
 {
-    if (first_record)
-    {
-        current_record = first_record;
+    Unseal();
+    DropDefaults();
+    RetireHandles();
 
-        do
-        {
-        	current_record->enabled = false;
-            current_record=current_record->next;
-        } while (current_record);
-    }
+    for (current_record = first_record; current_record < last_record; current_record++)
+        current_record->enabled = false;
 
     Init();
 }
@@ -436,8 +1293,11 @@ template <class X> bool XTable<X>::Top()
 {
     if (!first_record) return false;
 
+    /// Default items come first
+    if ((defaults) && (SelectDefault(0))) return true;
+
     current_record = first_record;
-    if ((current_record && (!current_record->enabled))) return Next();
+    if ((!current_record->enabled) || (IsOverlaySlot(current_record))) return Next();
 
     return current_record->enabled;
 }
@@ -446,194 +1306,1561 @@ template <class X> bool XTable<X>::Next()
 {
     if ((!first_record) || (!current_record)) return false;
 
-    current_record = current_record->next;
-    if ((current_record && (!current_record->enabled))) Next();
+    /// Items inserted on SRAM follow the default ones (slots of updated default items are skipped)
+    if (current_default >= 0)
+    {
+        if (SelectDefault(current_default + 1)) return true;
+        current_record = first_record;
+    }
+    else current_record++;
+
+    while ((current_record < last_record) && ((!current_record->enabled) || (IsOverlaySlot(current_record))))
+        current_record++;
+
+    if (current_record == last_record) current_record = NULL;
 
     return (current_record);
 }
 
-template <class X> unsigned int XTable<X>::Counter()
+template <class X> X* XTable<X>::At(unsigned int index)
 {
-	return counter;
+    XItem<X> *record;
+
+    if (defaults) return (Seek(index) ? Select() : NULL);
+
+    record = GetRankRecord(index);
+    if (!record) return NULL;
+
+    return &(record->item);
 }
 
+template <class X> bool XTable<X>::Seek(unsigned int index)
+{
+    XItem<X> *record;
 
+    /// Default items have no slot until updated
+    if (defaults)
+    {
+        if ((index >= counter) || (!Top())) return false;
+        for (; index > 0; index--) if (!Next()) return false;
+        return true;
+    }
 
-// Status setting
-// 0: 				BMK=0x42 first status markers = Begin MaRKer
-// 1: 				buffer size (max number of items)
-// <buffer_size>+2: EMK=0x45 second status markers = End MaRKer
-//
-// <------------ status --------------------------------> <-------- data ------------------>
-// Marker Buf.Size <--- Status Buffer -----------> Marker <--- Parameter Buffer ----------->
-// (0x42) (<size>) (x) (x) (x) (x) ... (x) (x) (x) (0x45) (<data>) ... (<data>) ... (<data>)
-// BMK											   EMK
-//
-template <class X> bool XTable<X>::InitStorage(int start_location, int max_items) //uint8_t
+    record = GetRankRecord(index);
+    if (!record) return false;
+
+    current_record = record;
+    return true;
+}
+
+template <class X> bool XTable<X>::InitDefaults(const X *items, int count)
 {
-    eeprom_max_items = -1;
+    if ((!first_record) || (count < 0) || (count > 255) || (buffer_max_items > 254)) return false;
 
-    /// Validate buffer limits
-    if ((max_items<=0) || (max_items > 255) || (start_location<0)) return false;
+    Clean();
+    if (!count) return true;
 
-    /// Set EEPROM buffer startup pointer
-    eeprom_header_begin = start_location;
-    eeprom_max_items = max_items;
-    eeprom_parameter_begin = start_location + eeprom_max_items + 4;
+    overlay = new uint8_t[count];
+    overlay_slots = new uint8_t[(buffer_max_items+7)/8];
+    if ((!overlay) || (!overlay_slots))
+    {
+        DropDefaults();
+        return false;
+    }
+
+    memset(overlay, 0, count);
+    memset(overlay_slots, 0, (buffer_max_items+7)/8);
+
+    defaults = items;
+    defaults_count = count;
+    counter = count;
+
+    return true;
+}
+
+template <class X> unsigned int XTable<X>::Counter()
+{
+	return counter;
+}
+
+template <class X> bool XTable<X>::InitProfiles(int profiles_number)
+{
+    if ((!first_record) || (profiles) || (profiles_number < 2) || (profiles_number > 255)) return false;
+
+    profiles = new Profile[profiles_number];
+    if (!profiles) return false;
 
-    if ((NextFreeAddressStorage()-1) > E2END) return false;
+    profiles_max = profiles_number;
+    active_profile = 0;
 
-    if ( !((eeprom.read(eeprom_header_begin)==BMK) &&
-         (eeprom.read(eeprom_header_begin+eeprom_max_items+2)==EMK) &&
-         (eeprom.read(eeprom_header_begin+1) == eeprom_max_items)) )
+    /// Other profiles start without runtime list and storage
+    for (int profile=1; profile<profiles_max; profile++)
     {
-        eeprom.Fill(start_location, max_items*sizeof(XItem<X>) + max_items + 4, 0x00);
+        profiles[profile].counter = 0;
+        profiles[profile].first_record = NULL;
+        profiles[profile].current_record = NULL;
+        profiles[profile].eeprom_max_items = -1;
+        profiles[profile].eeprom_mode = LEGACY_STORAGE;
+        profiles[profile].save_pending = false;
+        profiles[profile].defaults = NULL;
+        profiles[profile].defaults_count = 0;
+        profiles[profile].current_default = -1;
+        profiles[profile].overlay = NULL;
+        profiles[profile].overlay_slots = NULL;
+    }
+
+    return true;
+}
+
+template <class X> bool XTable<X>::SelectProfile(int profile)
+{
+    XItem<X> *new_list;
 
-        /// Store status markers for initialized storage
-        eeprom.write(start_location, BMK);
-        eeprom.write(start_location+max_items+2, EMK);
+    if ((profile < 0) || (profile >= profiles_max)) return false;
+    if (profile == active_profile) return true;
 
-        /// Store buffer size at first storage pointer
-        eeprom.write(start_location+1, max_items);
+    /// Runtime list on demand
+    if (!profiles[profile].first_record)
+    {
+        new_list = new XItem<X>[buffer_max_items];
+        if (!new_list) return false;
+
+        for (unsigned int it=0; it<buffer_max_items; it++) new_list[it].enabled = false;
+        profiles[profile].first_record = new_list;
     }
 
-    return CheckStorage();
+    /// Slots of a different runtime list
+    RetireHandles();
+    dense_items = 0;
+    ranks_valid = false;
+
+    StoreProfile(&profiles[active_profile]);
+    RestoreProfile(&profiles[profile]);
+    active_profile = profile;
+
+    return true;
 }
 
+template <class X> int XTable<X>::CurrentProfile()
+{
+    return active_profile;
+}
 
-template <class X> int XTable<X>::GetTopAddressStorage()
+template <class X> void XTable<X>::StoreProfile(Profile *profile)
 {
-    return top_parameter_ptr;
+    profile->counter = counter;
+    profile->first_record = first_record;
+    profile->current_record = current_record;
+    profile->eeprom_header_begin = eeprom_header_begin;
+    profile->eeprom_status_begin = eeprom_status_begin;
+    profile->eeprom_status_size = eeprom_status_size;
+    profile->eeprom_parameter_begin = eeprom_parameter_begin;
+    profile->eeprom_max_items = eeprom_max_items;
+    profile->eeprom_mode = eeprom_mode;
+    profile->top_status_ptr = top_status_ptr;
+    profile->top_parameter_ptr = top_parameter_ptr;
+    profile->save_pending = save_pending;
+    profile->save_pending_since = save_pending_since;
+    profile->defaults = defaults;
+    profile->defaults_count = defaults_count;
+    profile->current_default = current_default;
+    profile->overlay = overlay;
+    profile->overlay_slots = overlay_slots;
 }
 
+template <class X> void XTable<X>::RestoreProfile(Profile *profile)
+{
+    counter = profile->counter;
+    first_record = profile->first_record;
+    last_record = first_record + buffer_max_items;
+    current_record = profile->current_record;
+    eeprom_header_begin = profile->eeprom_header_begin;
+    eeprom_status_begin = profile->eeprom_status_begin;
+    eeprom_status_size = profile->eeprom_status_size;
+    eeprom_parameter_begin = profile->eeprom_parameter_begin;
+    eeprom_max_items = profile->eeprom_max_items;
+    eeprom_mode = profile->eeprom_mode;
+    top_status_ptr = profile->top_status_ptr;
+    top_parameter_ptr = profile->top_parameter_ptr;
+    save_pending = profile->save_pending;
+    save_pending_since = profile->save_pending_since;
+    defaults = profile->defaults;
+    defaults_count = profile->defaults_count;
+    current_default = profile->current_default;
+    overlay = profile->overlay;
+    overlay_slots = profile->overlay_slots;
+
+    /// Shared item of the default ones read back from flash
+    if (current_default >= 0) SelectDefault(current_default);
+}
 
-template <class X> int XTable<X>::NextFreeAddressStorage()
+/// Fletcher sums (modulo 2^16) of generation, storage context and whole runtime list (disabled
+/// slots included): two additions for each byte, quicker than any multiply on 8 bit targets
+template <class X> uint32_t XTable<X>::GetResidentHash()
 {
-    if (eeprom_max_items<0) return -1;
-    else return eeprom_max_items*sizeof(XItem<X>) + eeprom_max_items + 4 + eeprom_header_begin;
+    uint16_t sum = 0;
+    uint16_t sum_of_sums = 0;
+    const uint8_t *bytes;
+
+    bytes = (const uint8_t *) &resident->generation;
+    for (unsigned int j=0; j<sizeof(resident->generation); j++) { sum += bytes[j]; sum_of_sums += sum; }
+
+    bytes = (const uint8_t *) &resident->context;
+    for (unsigned int j=0; j<sizeof(Profile); j++) { sum += bytes[j]; sum_of_sums += sum; }
+
+    bytes = (const uint8_t *) first_record;
+    for (unsigned int j=0; j<buffer_max_items*sizeof(XItem<X>); j++) { sum += bytes[j]; sum_of_sums += sum; }
+
+    return ((uint32_t) sum_of_sums << 16) | sum;
 }
 
+template <class X> void XTable<X>::Unseal()
+{
+    if ((resident) && (resident->context.first_record == first_record)) resident->magic = 0;
+}
 
-template <class X> bool XTable<X>::CheckStorage()
+template <class X> void XTable<X>::DeleteList(XItem<X> *list)
 {
-    if ((eeprom_max_items<=0) || (eeprom_max_items > 255) || (eeprom_header_begin<0)) return false;
+    /// The resident buffer is not allocated by the table
+    if ((!resident) || (list != resident->context.first_record)) delete[] list;
+}
 
-    if ( (eeprom.read(eeprom_header_begin)==BMK) &&
-         (eeprom.read(eeprom_header_begin+eeprom_max_items+2)==EMK) &&
-         (eeprom.read(eeprom_header_begin+1) == eeprom_max_items) )
+/// Updated default items are read from their slot, the other ones from flash into the shared item
+template <class X> bool XTable<X>::SelectDefault(int index)
+{
+    for (; index < defaults_count; index++)
     {
-        GetTopLocation();
+        if (overlay[index] == 0xFF) continue;
+
+        current_default = index;
+        if (overlay[index]) current_record = first_record + overlay[index] - 1;
+        else
+        {
+            XTABLE_READ_DEFAULT(&xitem->item, defaults + index);
+            xitem->enabled = true;
+            current_record = xitem;
+        }
         return true;
     }
-    else return false;
+
+    current_default = -1;
+    return false;
 }
 
-template <class X> int XTable<X>::IncCurrentLocation(int curr_location)
+template <class X> bool XTable<X>::IsOverlaySlot(XItem<X> *record)
 {
-    return ((curr_location+1-2)<(eeprom_header_begin + eeprom_max_items) ? curr_location+1 : eeprom_header_begin+2);
+    return ((overlay_slots) && (overlay_slots[(record - first_record)/8] & (1 << ((record - first_record)%8))));
 }
 
-template  <class X> int XTable<X>::GetLocationFromStatus(int curr_status_ptr)
+template <class X> void XTable<X>::DropDefaults()
 {
-    return (curr_status_ptr-eeprom_header_begin-2)*sizeof(XItem<X>) + eeprom_parameter_begin;
+    delete[] overlay;
+    delete[] overlay_slots;
+
+    defaults = NULL;
+    defaults_count = 0;
+    overlay = NULL;
+    overlay_slots = NULL;
+    current_default = -1;
 }
 
-template <class X> void XTable<X>::GetTopLocation()
+/// Enabled slot of the same generation, out of the slots of updated default items
+template <class X> typename XTable<X>::template XItem<X> *XTable<X>::GetHandleRecord(Handle handle)
 {
-    int current_location;
-    int next_location;
-    int tmp_location;
+    XItem<X> *record;
 
-    current_location = eeprom_header_begin+2;
-    next_location = current_location+1;
+    if ((!generations) || ((handle & 0x00FFFFFFUL) >= buffer_max_items)) return NULL;
 
-    while (eeprom.read(next_location) == eeprom.read(current_location)+1)
-    {
-        tmp_location = next_location;
-        next_location = IncCurrentLocation(next_location);
-        current_location = tmp_location;
-    }
+    record = first_record + (handle & 0x00FFFFFFUL);
+    if ((generations[record - first_record] != (uint8_t) (handle >> 24)) || (!record->enabled) || (IsOverlaySlot(record))) return NULL;
 
-    top_status_ptr = current_location;
-    top_parameter_ptr = GetLocationFromStatus(top_status_ptr);
+    return record;
 }
 
-
-template <class X> void XTable<X>::PutTopLocation()
+/// Generation 0 is skipped, so that no handle is 0
+template <class X> void XTable<X>::RetireHandle(XItem<X> *record)
 {
-    uint8_t current_value;
+    if ((!generations) || (record < first_record) || (record >= last_record)) return;
 
-    current_value = eeprom.read(top_status_ptr);
-    top_status_ptr = IncCurrentLocation(top_status_ptr);
-    eeprom.write(top_status_ptr, current_value+1);
-    top_parameter_ptr = GetLocationFromStatus(top_status_ptr);
+    if (!++generations[record - first_record]) generations[record - first_record] = 1;
 }
 
-template <class X> bool XTable<X>::SaveStorage()
+template <class X> void XTable<X>::RetireHandles()
 {
-    bool dataCheck;
-    int curr_status_ptr;
-    int curr_parameter_ptr;
+    if (!generations) return;
 
-    if (!CheckStorage()) return false;
+    for (XItem<X> *record = first_record; record < last_record; record++)
+        if (record->enabled) RetireHandle(record);
+}
 
-    PutTopLocation();
-    curr_status_ptr = top_status_ptr;
-    curr_parameter_ptr = top_parameter_ptr;
+/// Enabled flag of a slot, kept in line with the leading enabled slots and the rank index
+template <class X> void XTable<X>::EnableSlot(XItem<X> *record, bool enabled)
+{
+    unsigned int slot;
 
-    if (Top())
-    do
-    {
-        xitem->item = current_record->item;
-        xitem->enabled = current_record->enabled;
+    if (record->enabled == enabled) return;
+    record->enabled = enabled;
 
-        eeprom.Write(curr_parameter_ptr, *xitem);
-        curr_status_ptr = IncCurrentLocation(curr_status_ptr);
-        curr_parameter_ptr = GetLocationFromStatus(curr_status_ptr);
-    } while (Next());
+    /// Shared item of the default ones
+    if ((record < first_record) || (record >= last_record)) return;
+
+    slot = record - first_record;
+    if ((!enabled) && (slot < dense_items)) dense_items = slot;
+    if ((enabled) && (slot == dense_items))
+        while ((dense_items < buffer_max_items) && (first_record[dense_items].enabled)) dense_items++;
+
+    if (ranks_valid)
+        for (unsigned int block = slot/8 + 1; block <= ranks_blocks; block += block & (~block + 1))
+            ranks[block-1] += (enabled ? 1 : -1);
+}
+
+/// Leading enabled slots are reached directly, the other ones through the block of the rank index
+/// found by binary lifting and a scan of its 8 slots
+template <class X> typename XTable<X>::template XItem<X> *XTable<X>::GetRankRecord(unsigned int index)
+{
+    XItem<X> *record;
+    unsigned int block;
+    unsigned int step;
+
+    if ((!first_record) || (index >= counter)) return NULL;
+    if (index < dense_items) return first_record + index;
+
+    if ((!ranks_valid) && (!BuildRanks())) return NULL;
+    if (index < dense_items) return first_record + index;
+
+    for (step = 1; (step << 1) <= ranks_blocks; step <<= 1);
+
+    block = 0;
+    for (; step; step >>= 1)
+    {
+        if ((block + step <= ranks_blocks) && (ranks[block + step - 1] <= index))
+        {
+            block += step;
+            index -= ranks[block - 1];
+        }
+    }
+
+    for (record = first_record + 8*block; record < last_record; record++)
+        if ((record->enabled) && (!index--)) return record;
+
+    return NULL;
+}
+
+/// Counters of each block, then partial sums of the Fenwick tree in a single pass
+template <class X> bool XTable<X>::BuildRanks()
+{
+    unsigned int slot;
+    unsigned int block;
+
+    if (!ranks)
+    {
+        ranks_blocks = (buffer_max_items + 7)/8;
+        ranks = new unsigned int[ranks_blocks];
+        if (!ranks) return false;
+    }
+
+    memset(ranks, 0, ranks_blocks*sizeof(unsigned int));
+    for (slot = 0; slot < buffer_max_items; slot++)
+        if (first_record[slot].enabled) ranks[slot/8]++;
+
+    for (block = 1; block <= ranks_blocks; block++)
+        if (block + (block & (~block + 1)) <= ranks_blocks) ranks[block + (block & (~block + 1)) - 1] += ranks[block - 1];
+
+    for (dense_items = 0; (dense_items < buffer_max_items) && (first_record[dense_items].enabled); dense_items++);
+    ranks_valid = true;
+
+    return true;
+}
+
+/// Items in the order of Top and Next from the given position (default items first, then
+/// the other slots): default items not updated are read from flash into the caller buffer
+template <class X> typename XTable<X>::template XItem<X> *XTable<X>::GetStoredRecord(int *position, XItem<X> *buffer)
+{
+    XItem<X> *record;
+    int index;
+
+    while (*position < defaults_count)
+    {
+        index = (*position)++;
+        if (overlay[index] == 0xFF) continue;
+        if (overlay[index]) return first_record + overlay[index] - 1;
+
+        XTABLE_READ_DEFAULT(&buffer->item, defaults + index);
+        buffer->enabled = true;
+        return buffer;
+    }
+
+    for (record = first_record + *position - defaults_count; record < last_record; record++)
+    {
+        if ((!record->enabled) || (IsOverlaySlot(record))) continue;
+
+        *position = record - first_record + defaults_count + 1;
+        return record;
+    }
+
+    return NULL;
+}
+
+/// Last written location of the slot (-1 for empty slot): written bytes come before erased ones
+template <class X> int XTable<X>::GetProfileLocation(int start_location, int size)
+{
+    int location = start_location;
+
+    while ((location < start_location+size) && (eeprom.read(location) != 0xFF)) location++;
+
+    return location-1;
+}
+
+template <class X> bool XTable<X>::SaveProfile(int start_location, int size)
+{
+    int location;
+
+    if ((start_location<0) || (size<=0) || ((start_location+size-1) > XEEPROM_END)) return false;
+
+    location = GetProfileLocation(start_location, size);
+    if ((location >= start_location) && (eeprom.read(location) == active_profile)) return true;
+
+    /// Erase the whole slot once it is full
+    if (++location == start_location+size)
+    {
+        eeprom.Erase(start_location, size);
+        location = start_location;
+    }
+
+    /// Erased location: write-only cycle with XEEPROM_SPLIT_CYCLES
+    eeprom.update(location, active_profile);
+    eeprom.Flush();
+
+    return true;
+}
+
+template <class X> int XTable<X>::LoadProfile(int start_location, int size)
+{
+    int location;
+
+    if ((start_location<0) || (size<=0) || ((start_location+size-1) > XEEPROM_END)) return -1;
+
+    location = GetProfileLocation(start_location, size);
+    if (location < start_location) return -1;
+
+    return eeprom.read(location);
+}
+
+
+
+// Status setting
+// 0: 				BMK=0x42 first status markers = Begin MaRKer
+// 1: 				buffer size (max number of items)
+// <buffer_size>+2: EMK=0x45 second status markers = End MaRKer
+//
+// <------------ status --------------------------------> <-------- data ------------------>
+// Marker Buf.Size <--- Status Buffer -----------> Marker <--- Parameter Buffer ----------->
+// (0x42) (<size>) (x) (x) (x) (x) ... (x) (x) (x) (0x45) (<data>) ... (<data>) ... (<data>)
+// BMK											   EMK
+//
+template <class X> bool XTable<X>::InitStorage(int start_location, int max_items) //uint8_t
+{
+    return InitStorage(start_location, max_items, LEGACY_STORAGE);
+}
+
+// Extended status setting (any mode but LEGACY_STORAGE)
+// 0:               XMK=0x58 first status marker = eXtended MarKer
+// 1:               buffer size (max number of items)
+// 2:               storage mode
+// 3+2*<index>:     status value of each location
+// 4+2*<index>:     counter of items stored from each location
+// 2*<buffer_size>+3: EMK=0x45 second status marker
+// 2*<buffer_size>+4: wear counters (WEAR_TELEMETRY only, 8 bytes)
+// then:            schema version and size of stored items (SCHEMA_VERSION only, 3 bytes)
+// then:            hash of the collection stored from each location (SNAPSHOT_HASH only, 4 bytes each)
+// then:            patched item of each location or 0xFF (DELTA_SNAPSHOTS only, 1 byte each)
+//
+template <class X> bool XTable<X>::InitStorage(int start_location, int max_items, uint8_t mode)
+{
+    eeprom_max_items = -1;
+
+    /// Validate buffer limits
+    if ((max_items<=0) || (max_items > 255) || (start_location<0)) return false;
+
+    /// Set EEPROM buffer startup pointer
+    eeprom_header_begin = start_location;
+    eeprom_max_items = max_items;
+    eeprom_mode = mode;
+
+    if (eeprom_mode == LEGACY_STORAGE)
+    {
+        eeprom_status_begin = start_location + 2;
+        eeprom_status_size = 1;
+    }
+    else
+    {
+        eeprom_status_begin = start_location + 3;
+        eeprom_status_size = 2;
+    }
+
+    eeprom_parameter_begin = start_location + HeaderSize(eeprom_max_items, eeprom_mode);
+
+    if ((NextFreeAddressStorage()-1) > XEEPROM_END) return false;
+
+    if (!CheckMarkers()) FormatStorage();
+
+    return CheckStorage();
+}
+
+template <class X> void XTable<X>::FormatStorage()
+{
+    /// Only the header is formatted, parameter and hash locations are don't-care until stored
+    eeprom.Fill(eeprom_header_begin, (eeprom_mode & SNAPSHOT_HASH ? GetHashLocation(eeprom_status_begin) : eeprom_parameter_begin) - eeprom_header_begin, 0x00);
+
+    /// Store status markers for initialized storage
+    eeprom.write(eeprom_header_begin, (eeprom_mode == LEGACY_STORAGE ? BMK : XMK));
+    eeprom.write(GetEndMarkerLocation(), EMK);
+
+    /// Store buffer size at first storage pointer
+    eeprom.write(eeprom_header_begin+1, eeprom_max_items);
+
+    if (eeprom_mode != LEGACY_STORAGE) eeprom.write(eeprom_header_begin+2, eeprom_mode);
+
+    GetTopLocation();
+
+    /// Stored collections count from the location following the top one
+    if (eeprom_mode & WEAR_TELEMETRY)
+        WriteLong(GetWearLocation(), eeprom_max_items - GetIndexFromStatus(top_status_ptr));
+
+    if (eeprom_mode & SCHEMA_VERSION)
+    {
+        eeprom.write(GetSchemaLocation(), schema_version);
+        eeprom.write(GetSchemaLocation()+1, RecordSize(eeprom_mode) >> 8);
+        eeprom.write(GetSchemaLocation()+2, RecordSize(eeprom_mode) & 0xFF);
+    }
+
+    if (eeprom_mode & SNAPSHOT_HASH) WriteLong(GetHashLocation(top_status_ptr), 0);
+    if (eeprom_mode & DELTA_SNAPSHOTS) eeprom.write(GetDeltaLocation(top_status_ptr), 0xFF);
+
+    eeprom.Flush();
+}
+
+template <class X> bool XTable<X>::CheckSchema()
+{
+    if (!(eeprom_mode & SCHEMA_VERSION)) return true;
+
+    return ( (eeprom.read(GetSchemaLocation()) == schema_version) &&
+             (eeprom.read(GetSchemaLocation()+1) == (RecordSize(eeprom_mode) >> 8)) &&
+             (eeprom.read(GetSchemaLocation()+2) == (RecordSize(eeprom_mode) & 0xFF)) );
+}
+
+template <class X> void XTable<X>::SetSchema(uint8_t version, bool (*migrate)(uint8_t stored_version, XItem<X> *record, unsigned int stored_size))
+{
+    schema_version = version;
+    schema_migrate = migrate;
+}
+
+
+template <class X> template <class L, int I> bool XTable<X>::InitStorage()
+{
+    typedef typename L::template Region<I>::Type R;
+
+    /// Compile error if the region describes items of a different type
+    XItem<typename R::Type> *region_item = (XItem<X> *) NULL;
+    (void) region_item;
+
+    return InitStorage(L::Begin(I), R::MaxItems, R::Mode);
+}
+
+
+template <class X> bool XTable<X>::InitPoolStorage(int start_location, int end_location, uint8_t mode)
+{
+    int max_items;
+
+    if ((start_location<0) || (end_location>XEEPROM_END) || (end_location<start_location)) return false;
+
+    /// Largest number of locations fitting into the area
+    max_items = (end_location - start_location + 1 - SizeStorage(0, mode)) / (SizeStorage(1, mode) - SizeStorage(0, mode));
+    if (max_items > 255) max_items = 255;
+
+    if ((max_items<=0) || ((first_record) && (max_items < (int) buffer_max_items))) return false;
+
+    return InitStorage(start_location, max_items, mode);
+}
+
+
+template <class X> int XTable<X>::GetTopAddressStorage()
+{
+    return top_parameter_ptr;
+}
+
+
+template <class X> int XTable<X>::NextFreeAddressStorage()
+{
+    if (eeprom_max_items<0) return -1;
+    else return eeprom_header_begin + SizeStorage(eeprom_max_items, eeprom_mode);
+}
+
+
+template <class X> constexpr int XTable<X>::SizeStorage(int max_items, uint8_t mode)
+{
+    return HeaderSize(max_items, mode) + max_items*RecordSize(mode);
+}
+
+/// Markers, buffer size, status buffer and legacy counter or mode, then the extended header
+/// (see InitStorage)
+template <class X> constexpr int XTable<X>::HeaderSize(int max_items, uint8_t mode)
+{
+    return (mode == LEGACY_STORAGE ? max_items + 4 :
+            2*max_items + 4 + (mode & WEAR_TELEMETRY ? 8 : 0) + (mode & SCHEMA_VERSION ? 3 : 0) +
+            (mode & SNAPSHOT_HASH ? 4*max_items : 0) + (mode & DELTA_SNAPSHOTS ? max_items : 0));
+}
+
+
+template <class X> bool XTable<X>::CheckStorage()
+{
+    if ((eeprom_max_items<=0) || (eeprom_max_items > 255) || (eeprom_header_begin<0)) return false;
+
+    if (CheckMarkers())
+    {
+        GetTopLocation();
+        return true;
+    }
+    else return false;
+}
+
+template <class X> bool XTable<X>::CheckMarkers()
+{
+    if (eeprom_mode == LEGACY_STORAGE)
+        return ( (eeprom.read(eeprom_header_begin)==BMK) &&
+                 (eeprom.read(GetEndMarkerLocation())==EMK) &&
+                 (eeprom.read(eeprom_header_begin+1) == eeprom_max_items) );
+
+    return ( (eeprom.read(eeprom_header_begin)==XMK) &&
+             (eeprom.read(GetEndMarkerLocation())==EMK) &&
+             (eeprom.read(eeprom_header_begin+1) == eeprom_max_items) &&
+             (eeprom.read(eeprom_header_begin+2) == eeprom_mode) );
+}
+
+template <class X> int XTable<X>::GetEndMarkerLocation()
+{
+    return eeprom_status_begin + eeprom_max_items*eeprom_status_size;
+}
+
+template <class X> int XTable<X>::IncCurrentLocation(int curr_location)
+{
+    return (curr_location+eeprom_status_size < GetEndMarkerLocation() ? curr_location+eeprom_status_size : eeprom_status_begin);
+}
+
+template <class X> int XTable<X>::DecCurrentLocation(int curr_location)
+{
+    return (curr_location > eeprom_status_begin ? curr_location-eeprom_status_size : GetEndMarkerLocation()-eeprom_status_size);
+}
+
+template  <class X> int XTable<X>::GetIndexFromStatus(int curr_status_ptr)
+{
+    /// Status size is 1 or 2 bytes
+    return (curr_status_ptr-eeprom_status_begin) >> (eeprom_status_size-1);
+}
+
+template  <class X> int XTable<X>::GetLocationFromStatus(int curr_status_ptr)
+{
+    return GetIndexFromStatus(curr_status_ptr)*RecordSize(eeprom_mode) + eeprom_parameter_begin;
+}
+
+/// Legacy counter is the byte before the related parameter location,
+/// extended one follows the related status value
+template  <class X> int XTable<X>::GetCounterLocation(int curr_status_ptr)
+{
+    if (eeprom_mode == LEGACY_STORAGE) return GetLocationFromStatus(curr_status_ptr)-1;
+    else return curr_status_ptr+1;
+}
+
+template <class X> void XTable<X>::GetTopLocation()
+{
+    int current_location;
+    int next_location;
+    int tmp_location;
+    uint8_t first_value;
+
+    current_location = eeprom_status_begin;
+    next_location = IncCurrentLocation(current_location);
+
+    if (eeprom_mode & BITCLEAR_STATUS)
+    {
+        /// Top location is the last one written along current round of the buffer
+        first_value = eeprom.read(current_location);
+        while ((next_location != eeprom_status_begin) && (eeprom.read(next_location) == first_value))
+        {
+            current_location = next_location;
+            next_location = IncCurrentLocation(next_location);
+        }
+    }
+    else
+    while (eeprom.read(next_location) == (uint8_t) (eeprom.read(current_location)+1))
+    {
+        tmp_location = next_location;
+        next_location = IncCurrentLocation(next_location);
+        current_location = tmp_location;
+    }
+
+    top_status_ptr = current_location;
+    top_parameter_ptr = GetLocationFromStatus(top_status_ptr);
+}
+
+
+template <class X> void XTable<X>::PutTopLocation()
+{
+    uint8_t current_value;
+
+    current_value = eeprom.read(top_status_ptr);
+    top_status_ptr = IncCurrentLocation(top_status_ptr);
+
+    /// Round completed: counters of the status buffer are going to be overwritten
+    if ((eeprom_mode & WEAR_TELEMETRY) && (top_status_ptr == eeprom_status_begin))
+        PutWearCounters();
+
+    /// Bit-clear status moves to the next value (one more bit to 0) at each new round
+    if (eeprom_mode & BITCLEAR_STATUS)
+    {
+        if (top_status_ptr == eeprom_status_begin)
+            current_value = (current_value ? current_value >> 1 : 0xFF);
+    }
+    else current_value++;
+
+    eeprom.update(top_status_ptr, current_value);
+    top_parameter_ptr = GetLocationFromStatus(top_status_ptr);
+}
+
+template <class X> bool XTable<X>::SaveStorage()
+{
+    bool dataCheck;
+    bool delta;
+    int run;
+    int run_limit;
+    int curr_parameter_ptr;
+    int position;
+    uint32_t hash;
+    XItem<X> *record;
+    XItem<X> buffer;
+
+    save_written = false;
+
+    if ((!first_record) || (!CheckStorage())) return false;
+    if ((counter > 255) || ((counter > (unsigned int) eeprom_max_items) && (!(eeprom_mode & COMPRESSED_RECORDS)))) return false;
+
+    /// Compressed items must fit into the parameter buffer
+    if ((eeprom_mode & COMPRESSED_RECORDS) &&
+        (PutStream(top_parameter_ptr, STREAM_LENGTH) > eeprom_max_items*RecordSize(eeprom_mode))) return false;
+
+    /// Items stored with a different schema are replaced as a whole
+    if (!CheckSchema()) FormatStorage();
+
+    /// Unchanged table already stored from the top location
+    if (eeprom_mode & SNAPSHOT_HASH)
+    {
+        hash = GetSnapshotHash();
+        if ((eeprom.read(GetCounterLocation(top_status_ptr)) == counter) &&
+            (ReadLong(GetHashLocation(top_status_ptr)) == hash))
+        {
+            save_pending = false;
+            Seal();
+            return true;
+        }
+    }
+
+    /// Only items changed from the stored collection, as patches of it
+    save_written = true;
+    delta = PutDelta();
+
+    if (!delta)
+    {
+        PutTopLocation();
+        if (eeprom_mode & DELTA_SNAPSHOTS) eeprom.update(GetDeltaLocation(top_status_ptr), 0xFF);
+    }
+    curr_parameter_ptr = top_parameter_ptr;
+    run_limit = eeprom_max_items - GetIndexFromStatus(top_status_ptr);
+
+    /// Compressed items are a single stream from the top location
+    if ((eeprom_mode & COMPRESSED_RECORDS) && (!delta)) PutStream(top_parameter_ptr, STREAM_STORE);
+
+    /// Store each run of enabled slots as it is, split only at the end of the circular buffer
+    /// (default items and updated ones are stored one by one, see InitDefaults)
+    position = 0;
+    while ((!(eeprom_mode & COMPRESSED_RECORDS)) && (!delta) && ((record = GetStoredRecord(&position, &buffer))))
+    {
+        run = 1;
+        if (position > defaults_count)
+            while ((record + run < last_record) && (record[run].enabled) && (!IsOverlaySlot(record + run)) && (run < run_limit)) run++;
+        position += run - 1;
+
+        PutRecords(curr_parameter_ptr, record, run);
+
+        /// Locations left up to the end of the circular buffer
+        run_limit -= run;
+        curr_parameter_ptr += run*RecordSize(eeprom_mode);
+        if (!run_limit)
+        {
+            run_limit = eeprom_max_items;
+            curr_parameter_ptr = eeprom_parameter_begin;
+        }
+    }
 
     /// Update counter of available items
-    eeprom.write(top_parameter_ptr-1, counter);
+    eeprom.update(GetCounterLocation(top_status_ptr), counter);
+    if (eeprom_mode & SNAPSHOT_HASH) WriteLong(GetHashLocation(top_status_ptr), hash);
+
+    /// Pending bytes of page-oriented EEPROM
+    eeprom.Flush();
+
+    /// Raw check of data within EEPROM
+    dataCheck = CheckStorage();
+    dataCheck &= (eeprom.read(GetCounterLocation(top_status_ptr))==Counter());
+
+    /// Any pending request is satisfied
+    if (dataCheck)
+    {
+        save_pending = false;
+        Seal();
+    }
+
+    return dataCheck;
+}
+
+
+template <class X> void XTable<X>::SetSavePolicy(unsigned long window_ms, unsigned int max_saves, unsigned long period_ms)
+{
+    save_window = window_ms;
+    save_budget = max_saves;
+    save_period = period_ms;
+    save_budget_count = 0;
+}
+
+template <class X> bool XTable<X>::RequestSave(unsigned long now)
+{
+    if (save_pending) saves_avoided++;
+    else
+    {
+        save_pending = true;
+        save_pending_since = now;
+    }
+
+    return FlushStorage(now);
+}
+
+template <class X> bool XTable<X>::FlushStorage(unsigned long now)
+{
+    if (!save_pending) return true;
+
+    /// Coalescing window still open
+    if (now - save_pending_since < save_window) return false;
 
-    /// Raw check of data within EEPROM
-    dataCheck = CheckStorage();
-    dataCheck &= (eeprom.read(top_parameter_ptr-1)==Counter());
+    /// Persistence budget of current period
+    if (save_budget)
+    {
+        if ((save_budget_count) && (now - save_budget_begin >= save_period)) save_budget_count = 0;
+        if (save_budget_count >= save_budget) return false;
+    }
 
-    return dataCheck;
+    if (!SaveStorage()) return false;
+
+    /// Only storing operations writing the EEPROM are charged to the budget
+    if (!save_written) saves_avoided++;
+    else if (save_budget)
+    {
+        if (!save_budget_count) save_budget_begin = now;
+        save_budget_count++;
+    }
+
+    return true;
+}
+
+template <class X> bool XTable<X>::FlushStorage()
+{
+    if (!save_pending) return true;
+
+    return SaveStorage();
+}
+
+template <class X> unsigned long XTable<X>::AvoidedSaves()
+{
+    return saves_avoided;
+}
+
+template <class X> void XTable<X>::SetDeltaChain(uint8_t max_patches)
+{
+    delta_chain_max = max_patches;
 }
 
 
 template <class X> bool XTable<X>::LoadStorage()
 {
     uint8_t count;
-    uint8_t idx;
+    int run;
+    int depth;
+    int base_status_ptr;
     int curr_status_ptr;
-    int curr_parameter_ptr;
+    uint8_t idx;
+    Stream stream;
 
-    if (!CheckStorage()) return false;
+    if ((!first_record) || (!CheckStorage())) return false;
 
     Clean();
-    count = eeprom.read(top_parameter_ptr-1);
+    count = eeprom.read(GetCounterLocation(top_status_ptr));
+
+    if (count > buffer_max_items) return false;
+
+    if (!CheckSchema()) return MigrateStorage(count);
+
+    /// Base collection of the patches, if any
+    depth = GetDeltaDepth(&base_status_ptr);
+    if (depth < 0) return false;
+
+    if (eeprom_mode & COMPRESSED_RECORDS)
+    {
+        OpenStream(&stream, top_parameter_ptr);
+        for (run = 0; run < count; run++) GetStream(&stream, first_record + run);
+    }
+    else
+    {
+        /// Copy the run from the base location to the end of the circular buffer
+        run = eeprom_max_items - GetIndexFromStatus(base_status_ptr);
+        if (run > count) run = count;
+        GetRecords(GetLocationFromStatus(base_status_ptr), first_record, run);
+
+        /// Copy the remaining run wrapped at the beginning of the circular buffer
+        if (count > run) GetRecords(eeprom_parameter_begin, first_record + run, count - run);
+
+        /// Apply the patches in order
+        for (curr_status_ptr = base_status_ptr; depth > 0; depth--)
+        {
+            curr_status_ptr = IncCurrentLocation(curr_status_ptr);
+            idx = eeprom.read(GetDeltaLocation(curr_status_ptr));
+            if (idx < count) GetRecords(GetSlotLocation(GetIndexFromStatus(curr_status_ptr) + count - 1), first_record + idx, 1);
+        }
+    }
+
+    /// Only enabled items are stored
+    for (current_record = first_record; current_record < first_record + count; current_record++)
+        current_record->enabled = true;
+
+    current_record = NULL;
+    counter = count;
+
+    /// Runtime list back to the stored one
+    save_pending = false;
+    Seal();
+
+    return true;
+}
+
+
+template <class X> bool XTable<X>::MigrateStorage(uint8_t count)
+{
+    uint8_t stored_version;
+    unsigned int stored_size;
+    unsigned int encoded_size;
+    uint8_t media[RECORD_BUFFER];
+    int curr_parameter_ptr;
+    int base_status_ptr;
+    int index;
+    XItem<X> *record;
+
+    stored_version = eeprom.read(GetSchemaLocation());
+    stored_size = (eeprom.read(GetSchemaLocation()+1) << 8) + eeprom.read(GetSchemaLocation()+2);
+
+    if ((!schema_migrate) || (!stored_size) || (stored_size > (unsigned int) RecordSize(eeprom_mode))) return false;
+
+    /// Portable items keep their enabled flag after the encoding, raw items inside the XItem
+    encoded_size = stored_size;
+    if ((eeprom_mode & PORTABLE_RECORDS) && (!(eeprom_mode & PACKED_RECORDS))) encoded_size--;
+
+    /// Compressed items and patches depend on the previous size of the items as a whole
+    if ((eeprom_mode & COMPRESSED_RECORDS) || (GetDeltaDepth(&base_status_ptr))) return false;
+
+    /// Stored locations follow the previous size of the items
+    index = GetIndexFromStatus(top_status_ptr);
+    for (record = first_record; record < first_record + count; record++)
+    {
+        curr_parameter_ptr = eeprom_parameter_begin + index*stored_size;
+
+        /// Previous encoding is zero extended and decoded as LoadStorage does with the current one
+        memset(media, 0, RECORD_BUFFER);
+        for (unsigned int j=0; j<encoded_size; j++) media[j] = eeprom.read(curr_parameter_ptr + j);
+        DecodeRecord(media, record);
+
+        if (!schema_migrate(stored_version, record, stored_size))
+        {
+            Clean();
+            return false;
+        }
+        record->enabled = true;
+
+        if (++index == eeprom_max_items) index = 0;
+    }
+
+    current_record = NULL;
+    counter = count;
+    save_pending = false;
+    Seal();
+
+    return true;
+}
+
+template <class X> void XTable<X>::PreEraseLocation(int location, uint8_t next_value)
+{
+    uint8_t current_value = eeprom.read(location);
+
+    /// Unchanged bytes and bit-clear changes are programmed as they are by the next storing
+    if (((current_value & next_value) != next_value) && (next_value != 0xFF))
+        eeprom.erase(location);
+}
+
+template <class X> bool XTable<X>::PreEraseStorage()
+{
+    uint8_t count;
+    uint8_t status;
+    int distance;
+    int next_status_ptr;
+    int curr_parameter_ptr;
+    int parameter_end;
+    int depth;
+    int base_status_ptr;
+    int position;
+    XItem<X> *record;
+    XItem<X> buffer;
+    uint8_t media[XRecord<X>::Size + 1];
+    uint8_t *bytes;
+
+    /// Without erase-only cycles an erased location would cost a further atomic cycle
+    if ((!XEEPROM_SPLIT_CYCLES) || (!first_record) || (!CheckStorage()) || (!CheckSchema())) return false;
+
+    /// Locations of the base collection preceding the top one are still in use
+    depth = GetDeltaDepth(&base_status_ptr);
+    if (depth < 0) return false;
+
+    count = eeprom.read(GetCounterLocation(top_status_ptr));
+    status = eeprom.read(top_status_ptr);
+    next_status_ptr = IncCurrentLocation(top_status_ptr);
+
+    /// An erased status location must neither break the chain from the first
+    /// location nor look like the successor of the top one (0xFE + 1).
+    /// Bit-clear status needs no erase at all.
+    if ((!(eeprom_mode & BITCLEAR_STATUS)) && (next_status_ptr != eeprom_status_begin) && (status != 0xFE))
+        PreEraseLocation(next_status_ptr, status+1);
+
+    /// The next legacy counter location is the last byte of the top parameter location
+    if ((!count) || (eeprom_mode != LEGACY_STORAGE))
+        PreEraseLocation(GetCounterLocation(next_status_ptr), counter);
+
+    if (eeprom_mode & COMPRESSED_RECORDS)
+    {
+        PreEraseStream(next_status_ptr, count);
+        eeprom.Flush();
+        return true;
+    }
+
+    /// Parameter locations beyond the last stored collection of items, as expected
+    /// from current items on SRAM (the last byte before the top parameter location
+    /// keeps the legacy counter of the stored items)
+    curr_parameter_ptr = GetLocationFromStatus(next_status_ptr);
+    parameter_end = GetLocationFromStatus(GetEndMarkerLocation());
+    distance = 1;
+    for (position = 0; (record = GetStoredRecord(&position, &buffer)); )
+    {
+        if ((distance >= count) && (distance < eeprom_max_items - depth))
+        {
+            bytes = EncodeRecord(record, media);
+            for (int j=0; j<RecordSize(eeprom_mode) - ((distance == eeprom_max_items-1) && (eeprom_mode == LEGACY_STORAGE) ? 1 : 0); j++)
+                PreEraseLocation(curr_parameter_ptr + j, bytes[j]);
+        }
+
+        curr_parameter_ptr += RecordSize(eeprom_mode);
+        if (curr_parameter_ptr == parameter_end) curr_parameter_ptr = eeprom_parameter_begin;
+        distance++;
+    }
+
+    eeprom.Flush();
+
+    return true;
+}
 
-    curr_status_ptr = top_status_ptr;
+template <class X> bool XTable<X>::ForEachStored(XItem<X> *buffer, bool (*callback)(XItem<X> *buffer, void *context), void *context)
+{
+    uint8_t count;
+    uint8_t idx;
+    int curr_parameter_ptr;
+    int parameter_end;
+    int depth;
+    int base_status_ptr;
+    Stream stream;
+
+    if ((!buffer) || (!callback)) return false;
+    if ((!CheckStorage()) || (!CheckSchema())) return false;
+
+    depth = GetDeltaDepth(&base_status_ptr);
+    if (depth < 0) return false;
+
+    count = eeprom.read(GetCounterLocation(top_status_ptr));
     curr_parameter_ptr = top_parameter_ptr;
+    parameter_end = GetLocationFromStatus(GetEndMarkerLocation());
+
+    OpenStream(&stream, top_parameter_ptr);
+
+    for (idx=0; idx<count; idx++)
+    {
+        if (eeprom_mode & COMPRESSED_RECORDS) GetStream(&stream, buffer);
+        else if (depth) GetRecords(GetItemLocation(idx, count, depth), buffer, 1);
+        else GetRecords(curr_parameter_ptr, buffer, 1);
+        if (!callback(buffer, context)) return false;
+
+        curr_parameter_ptr += RecordSize(eeprom_mode);
+        if (curr_parameter_ptr == parameter_end) curr_parameter_ptr = eeprom_parameter_begin;
+    }
+
+    return true;
+}
+
+template <class X> bool XTable<X>::WearReport(WearInfo *report)
+{
+    int curr_status_ptr;
+    unsigned long cycles;
+    unsigned long rate;
+
+    if ((!report) || (!(eeprom_mode & WEAR_TELEMETRY)) || (!CheckStorage())) return false;
+
+    report->saves = ReadLong(GetWearLocation()) + GetIndexFromStatus(top_status_ptr) - eeprom_max_items;
+    report->items = ReadLong(GetWearLocation()+4);
+
+    /// Items stored along the current round
+    for (curr_status_ptr = eeprom_status_begin; curr_status_ptr <= top_status_ptr; curr_status_ptr += eeprom_status_size)
+        report->items += GetWrittenItems(curr_status_ptr);
+
+    report->bytes = report->items*RecordSize(eeprom_mode) + report->saves*(eeprom_status_size +
+                    (eeprom_mode & SNAPSHOT_HASH ? 4 : 0) + (eeprom_mode & DELTA_SNAPSHOTS ? 1 : 0));
+
+    report->max_cycles = (report->saves + eeprom_max_items - 1) / eeprom_max_items;
+    cycles = (report->items + eeprom_max_items - 1) / eeprom_max_items;
+    if (cycles > report->max_cycles) report->max_cycles = cycles;
+
+    if (report->max_cycles >= XEEPROM_ENDURANCE) report->remaining_saves = 0;
+    else if (!report->max_cycles) report->remaining_saves = XEEPROM_ENDURANCE * eeprom_max_items;
+    else
+    {
+        /// Saves for each cycle of the most worn location (up to <size>) as 8.8 fixed point
+        rate = ((report->saves / report->max_cycles) << 8) + ((report->saves % report->max_cycles) << 8) / report->max_cycles;
+        cycles = XEEPROM_ENDURANCE - report->max_cycles;
+        report->remaining_saves = (cycles >> 8)*rate + (((cycles & 0xFF)*rate) >> 8);
+    }
+
+    return true;
+}
+
+template <class X> template <class P> bool XTable<X>::PrintWearReport(P &output)
+{
+    WearInfo report;
+
+    if (!WearReport(&report)) return false;
+
+    output.print("XWEAR,");
+    output.print(eeprom_header_begin);
+    output.print(",");
+    output.print(eeprom_max_items);
+    output.print(",");
+    output.print(eeprom_mode);
+    output.print(",");
+    output.print(report.saves);
+    output.print(",");
+    output.print(report.items);
+    output.print(",");
+    output.print(report.bytes);
+    output.print(",");
+    output.print(report.max_cycles);
+    output.print(",");
+    output.println(report.remaining_saves);
+
+    return true;
+}
+
+/// Schema follows wear counters, if any: version and size of stored items (2 bytes)
+template <class X> int XTable<X>::GetSchemaLocation()
+{
+    return GetEndMarkerLocation() + 1 + (eeprom_mode & WEAR_TELEMETRY ? 8 : 0);
+}
+
+/// Hashes follow schema, if any: 4 bytes for each location
+template <class X> int XTable<X>::GetHashLocation(int curr_status_ptr)
+{
+    return GetSchemaLocation() + (eeprom_mode & SCHEMA_VERSION ? 3 : 0) + 4*GetIndexFromStatus(curr_status_ptr);
+}
+
+/// FNV-1a hash of the counter and of the enabled items as they are stored
+template <class X> uint32_t XTable<X>::GetSnapshotHash()
+{
+    uint32_t hash = 2166136261UL;
+    int position;
+    XItem<X> *record;
+    XItem<X> buffer;
+    uint8_t media[XRecord<X>::Size + 1];
+    uint8_t *bytes;
+
+    hash = (hash ^ counter) * 16777619UL;
+
+    for (position = 0; (record = GetStoredRecord(&position, &buffer)); )
+    {
+        bytes = EncodeRecord(record, media);
+        for (int j=0; j<RecordSize(eeprom_mode); j++)
+            hash = (hash ^ bytes[j]) * 16777619UL;
+    }
+
+    return hash;
+}
 
-    idx = 0;
-    while (idx < count)
+/// Stored items are XItem<X> as they are on SRAM or, with PORTABLE_RECORDS mode,
+/// the portable encoding of the item followed by the enabled flag.
+/// PACKED_RECORDS mode drops the enabled flag and the padding of XItem<X>.
+template <class X> constexpr int XTable<X>::RecordSize(uint8_t mode)
+{
+    return (mode & PACKED_RECORDS ? (mode & PORTABLE_RECORDS ? (int) XRecord<X>::Size : (int) sizeof(X)) :
+                                    (mode & PORTABLE_RECORDS ? (int) XRecord<X>::Size + 1 : (int) sizeof(XItem<X>)));
+}
+
+/// Stored items identical to XItem<X> on SRAM (i.e. portable encoding on AVR): runs copied as they are
+template <class X> bool XTable<X>::RawRecords()
+{
+    if (eeprom_mode & PACKED_RECORDS) return false;
+
+    return ((!(eeprom_mode & PORTABLE_RECORDS)) || (XRecord<X>::Raw && (sizeof(XItem<X>) == XRecord<X>::Size + 1)));
+}
+
+/// Bytes of the stored item: the record, the item itself or its encoding into the caller buffer
+template <class X> uint8_t *XTable<X>::EncodeRecord(XItem<X> *record, uint8_t *media)
+{
+    if (RawRecords()) return (uint8_t *) record;
+
+    if ((eeprom_mode & PACKED_RECORDS) && ((!(eeprom_mode & PORTABLE_RECORDS)) || XRecord<X>::Raw))
+        return (uint8_t *) &record->item;
+
+    XRecordEncode(&record->item, media);
+    if (!(eeprom_mode & PACKED_RECORDS)) media[XRecord<X>::Size] = (record->enabled ? 1 : 0);
+
+    return media;
+}
+
+template <class X> void XTable<X>::PutRecords(int location, XItem<X> *record, int count)
+{
+    uint8_t media[XRecord<X>::Size + 1];
+    uint8_t *bytes;
+
+    if (RawRecords())
+    {
+        eeprom.Update(location, record, count);
+        return;
+    }
+
+    /// Only changed bytes are written
+    for (; count>0; count--, record++, location += RecordSize(eeprom_mode))
+    {
+        bytes = EncodeRecord(record, media);
+        for (int j=0; j<RecordSize(eeprom_mode); j++) eeprom.update(location + j, bytes[j]);
+    }
+}
+
+template <class X> void XTable<X>::GetRecords(int location, XItem<X> *record, int count)
+{
+    uint8_t media[RECORD_BUFFER];
+
+    if (RawRecords())
+    {
+        eeprom.Read(location, record, count);
+        return;
+    }
+
+    for (; count>0; count--, record++, location += RecordSize(eeprom_mode))
+    {
+        for (int j=0; j<RecordSize(eeprom_mode); j++) media[j] = eeprom.read(location + j);
+
+        DecodeRecord(media, record);
+    }
+}
+
+template <class X> void XTable<X>::DecodeRecord(uint8_t *media, XItem<X> *record)
+{
+    if (RawRecords()) memcpy(record, media, sizeof(XItem<X>));
+    else if (eeprom_mode & PORTABLE_RECORDS) XRecordDecode(media, &record->item);
+    else memcpy(&record->item, media, sizeof(X));
+
+    /// Only enabled items are stored
+    record->enabled = true;
+}
+
+/// Compressed stream starts from a parameter location and wraps at the end of the parameter buffer
+template <class X> void XTable<X>::OpenStream(Stream *stream, int location)
+{
+    stream->location = location;
+    stream->length = 0;
+    stream->run = 0;
+
+    /// The first item is the delta from a zero item
+    memset(stream->previous, 0, RECORD_BUFFER);
+    memset(stream->delta, 0, RECORD_BUFFER);
+}
+
+template <class X> void XTable<X>::PutStreamByte(Stream *stream, uint8_t value, uint8_t operation)
+{
+    if (operation == STREAM_STORE) eeprom.update(stream->location, value);
+    else if ((operation == STREAM_PREERASE) && (stream->length >= stream->erase_begin) && (stream->length < stream->erase_end))
+        PreEraseLocation(stream->location, value);
+
+    stream->length++;
+    if (++stream->location == GetLocationFromStatus(GetEndMarkerLocation())) stream->location = eeprom_parameter_begin;
+}
+
+template <class X> uint8_t XTable<X>::GetStreamByte(Stream *stream)
+{
+    uint8_t value = eeprom.read(stream->location);
+
+    stream->length++;
+    if (++stream->location == GetLocationFromStatus(GetEndMarkerLocation())) stream->location = eeprom_parameter_begin;
+
+    return value;
+}
+
+/// Stream of the enabled items from the location: only its length, stored or pre-erased
+/// from the erase_begin-th byte up to the erase_end-th one
+template <class X> int XTable<X>::PutStream(int location, uint8_t operation, int erase_begin, int erase_end)
+{
+    Stream stream;
+    int position;
+    XItem<X> *record;
+    XItem<X> buffer;
+    uint8_t media[RECORD_BUFFER];
+    uint8_t *bytes;
+    uint8_t mask;
+    bool same;
+    int size = RecordSize(eeprom_mode);
+
+    OpenStream(&stream, location);
+    stream.erase_begin = erase_begin;
+    stream.erase_end = erase_end;
+
+    for (position = 0; (record = GetStoredRecord(&position, &buffer)); )
+    {
+        bytes = EncodeRecord(record, media);
+
+        same = true;
+        for (int j=0; j<size; j++)
+            if ((uint8_t) (bytes[j] - stream.previous[j]) != stream.delta[j]) same = false;
+
+        /// Same delta of the previous item: current run grows
+        if ((same) && (stream.run < 128)) stream.run++;
+        else
+        {
+            if (stream.run) PutStreamByte(&stream, stream.run-1, operation);
+            stream.run = (same ? 1 : 0);
+
+            if (!same)
+            {
+                for (int j=0; j<size; j++) stream.delta[j] = bytes[j] - stream.previous[j];
+
+                PutStreamByte(&stream, 0x80, operation);
+                for (int j=0; j<size; j+=8)
+                {
+                    mask = 0;
+                    for (int k=j; (k<j+8) && (k<size); k++) if (stream.delta[k]) mask |= 1 << (k-j);
+                    PutStreamByte(&stream, mask, operation);
+                }
+                for (int j=0; j<size; j++) if (stream.delta[j]) PutStreamByte(&stream, stream.delta[j], operation);
+            }
+        }
+
+        memcpy(stream.previous, bytes, size);
+    }
+
+    if (stream.run) PutStreamByte(&stream, stream.run-1, operation);
+
+    return stream.length;
+}
+
+/// Next item of the stream (NULL to skip it)
+template <class X> void XTable<X>::GetStream(Stream *stream, XItem<X> *record)
+{
+    uint8_t token;
+    uint8_t mask = 0;
+    int size = RecordSize(eeprom_mode);
+
+    if (!stream->run)
+    {
+        token = GetStreamByte(stream);
+        if (token & 0x80)
+        {
+            /// Bitmap of the non-zero bytes, then those bytes
+            for (int j=0; j<size; j++)
+            {
+                if (!(j & 7)) mask = GetStreamByte(stream);
+                stream->delta[j] = (mask >> (j & 7)) & 1;
+            }
+            for (int j=0; j<size; j++) if (stream->delta[j]) stream->delta[j] = GetStreamByte(stream);
+
+            stream->run = 1;
+        }
+        else stream->run = token + 1;
+    }
+
+    stream->run--;
+    for (int j=0; j<size; j++) stream->previous[j] += stream->delta[j];
+
+    if (record) DecodeRecord(stream->previous, record);
+}
+
+/// Bytes of the next stream not overlapping the stored one, that starts from the top location
+template <class X> void XTable<X>::PreEraseStream(int next_status_ptr, uint8_t count)
+{
+    Stream stream;
+    int size = RecordSize(eeprom_mode);
+
+    OpenStream(&stream, top_parameter_ptr);
+    for (uint8_t idx=0; idx<count; idx++) GetStream(&stream, NULL);
+
+    PutStream(GetLocationFromStatus(next_status_ptr), STREAM_PREERASE, stream.length - size, (eeprom_max_items - 1)*size);
+}
+
+/// Patches follow hashes, if any: 1 byte for each location
+template <class X> int XTable<X>::GetDeltaLocation(int curr_status_ptr)
+{
+    return GetHashLocation(eeprom_status_begin) + (eeprom_mode & SNAPSHOT_HASH ? 4*eeprom_max_items : 0) + GetIndexFromStatus(curr_status_ptr);
+}
+
+/// Patches from the full collection (base) up to the top location, -1 for a broken chain
+template <class X> int XTable<X>::GetDeltaDepth(int *base_status_ptr)
+{
+    int depth = 0;
+
+    *base_status_ptr = top_status_ptr;
+    if (!(eeprom_mode & DELTA_SNAPSHOTS)) return 0;
+
+    while (eeprom.read(GetDeltaLocation(*base_status_ptr)) != 0xFF)
     {
-        xitem = eeprom.Read(curr_parameter_ptr);
+        if (++depth >= eeprom_max_items) return -1;
+        *base_status_ptr = DecCurrentLocation(*base_status_ptr);
+    }
+
+    return depth;
+}
+
+/// Parameter location of any slot index, wrapped at the end of the circular buffer
+template <class X> int XTable<X>::GetSlotLocation(int index)
+{
+    return eeprom_parameter_begin + (index % eeprom_max_items)*RecordSize(eeprom_mode);
+}
+
+/// Latest stored version of the idx-th item: the last patch of it or the base collection.
+/// Each patch is stored <count>-1 slots beyond its own location, following the base collection.
+template <class X> int XTable<X>::GetItemLocation(uint8_t idx, uint8_t count, int depth)
+{
+    int curr_status_ptr = top_status_ptr;
+
+    for (; depth > 0; depth--, curr_status_ptr = DecCurrentLocation(curr_status_ptr))
+        if (eeprom.read(GetDeltaLocation(curr_status_ptr)) == idx)
+            return GetSlotLocation(GetIndexFromStatus(curr_status_ptr) + count - 1);
+
+    return GetSlotLocation(GetIndexFromStatus(curr_status_ptr) + idx);
+}
+
+template <class X> bool XTable<X>::IsStoredItem(XItem<X> *record, int location)
+{
+    uint8_t media[XRecord<X>::Size + 1];
+    uint8_t *bytes = EncodeRecord(record, media);
+
+    for (int j=0; j<RecordSize(eeprom_mode); j++)
+        if (eeprom.read(location + j) != bytes[j]) return false;
+
+    return true;
+}
 
-        if (Insert(xitem->item))
-			current_record->enabled = xitem->enabled;
-        else return false;
+/// Same number of items: one new location for each changed item (see SetDeltaChain)
+template <class X> bool XTable<X>::PutDelta()
+{
+    uint8_t count;
+    uint8_t idx;
+    int depth;
+    int base_status_ptr;
+    int changed;
+    int position;
+    XItem<X> *record;
+    XItem<X> buffer;
+
+    if ((!(eeprom_mode & DELTA_SNAPSHOTS)) || (eeprom_mode & COMPRESSED_RECORDS)) return false;
+
+    count = eeprom.read(GetCounterLocation(top_status_ptr));
+    depth = GetDeltaDepth(&base_status_ptr);
+    if ((!count) || (count != counter) || (depth < 0)) return false;
+
+    changed = 0;
+    for (position = 0, idx = 0; (record = GetStoredRecord(&position, &buffer)); )
+    {
+        if (!IsStoredItem(record, GetItemLocation(idx, count, depth))) changed++;
+        idx++;
+    }
 
-        curr_status_ptr = IncCurrentLocation(curr_status_ptr);
-		curr_parameter_ptr = GetLocationFromStatus(curr_status_ptr);
+    /// Chain and slots of the base collection and of the patches
+    if ((depth + changed > delta_chain_max) || (count + depth + changed > eeprom_max_items)) return false;
 
-		idx++;
+    for (position = 0, idx = 0; (record = GetStoredRecord(&position, &buffer)); )
+    {
+        if (!IsStoredItem(record, GetItemLocation(idx, count, depth)))
+        {
+            PutTopLocation();
+            eeprom.update(GetDeltaLocation(top_status_ptr), idx);
+            PutRecords(GetSlotLocation(GetIndexFromStatus(top_status_ptr) + count - 1), record, 1);
+            eeprom.update(GetCounterLocation(top_status_ptr), count);
+            depth++;
+        }
+        idx++;
     }
 
     return true;
 }
 
+/// Wear counters follow the end marker: collections stored up to the last round (4 bytes)
+/// and related items (4 bytes)
+template <class X> int XTable<X>::GetWearLocation()
+{
+    return GetEndMarkerLocation() + 1;
+}
+
+/// Items written from a location: the stored collection or a single patch (see DELTA_SNAPSHOTS)
+template <class X> uint8_t XTable<X>::GetWrittenItems(int curr_status_ptr)
+{
+    uint8_t count = eeprom.read(GetCounterLocation(curr_status_ptr));
+
+    if ((count) && (eeprom_mode & DELTA_SNAPSHOTS) && (eeprom.read(GetDeltaLocation(curr_status_ptr)) != 0xFF)) return 1;
+
+    return count;
+}
+
+/// Counters and hashes are kept MSB first
+template <class X> unsigned long XTable<X>::ReadLong(int location)
+{
+    unsigned long value = 0;
+
+    for (int i=0; i<4; i++) value = (value << 8) + eeprom.read(location+i);
+
+    return value;
+}
+
+template <class X> void XTable<X>::WriteLong(int location, unsigned long value)
+{
+    /// Only changed bytes are written
+    for (int i=3; i>=0; i--, value >>= 8) eeprom.update(location+i, value & 0xFF);
+}
+
+template <class X> void XTable<X>::PutWearCounters()
+{
+    int curr_status_ptr;
+    unsigned long items;
+
+    items = ReadLong(GetWearLocation()+4);
+    for (curr_status_ptr = eeprom_status_begin; curr_status_ptr < GetEndMarkerLocation(); curr_status_ptr += eeprom_status_size)
+        items += GetWrittenItems(curr_status_ptr);
+
+    WriteLong(GetWearLocation(), ReadLong(GetWearLocation()) + eeprom_max_items);
+    WriteLong(GetWearLocation()+4, items);
+}
+
 #endif /* XTable_H_ */